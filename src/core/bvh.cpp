@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "bvh.h"
+
+static Vec3f face_centroid(TinyMesh *mesh, TinyFace *face) {
+    Vec4f a = mesh->vertices[face->indices[0]].position;
+    Vec4f b = mesh->vertices[face->indices[1]].position;
+    Vec4f c = mesh->vertices[face->indices[2]].position;
+
+    return { (a.x + b.x + c.x) / 3, (a.y + b.y + c.y) / 3, (a.z + b.z + c.z) / 3 };
+}
+
+static void box_extend(BoundingBox *box, Vec3f p) {
+    box->min = { std::min(box->min.x, p.x), std::min(box->min.y, p.y), std::min(box->min.z, p.z) };
+    box->max = { std::max(box->max.x, p.x), std::max(box->max.y, p.y), std::max(box->max.z, p.z) };
+}
+
+static float axis_value(Vec3f v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+struct BvhBuild {
+    TinyMesh *mesh;
+    // Faces in build order, as indices into the shape's
+    std::vector<int> faces;
+    std::vector<Vec3f> centroids;
+    std::vector<BvhNode> nodes;
+};
+
+static int bvh_build_node(BvhBuild *build, PS_MeshShape *shape, int begin, int end) {
+    int node_idx = build->nodes.size();
+    build->nodes.push_back({});
+
+    BoundingBox bounds;
+    BoundingBox centroid_bounds;
+    Vec3f first = build->centroids[build->faces[begin]];
+    bounds = { first, first };
+    centroid_bounds = { first, first };
+
+    for (int i = begin; i < end; i++) {
+        TinyFace *face = &shape->faces[build->faces[i]];
+
+        for (int j = 0; j < 3; j++) {
+            box_extend(&bounds, vec3_from_vec4(build->mesh->vertices[face->indices[j]].position));
+        }
+        box_extend(&centroid_bounds, build->centroids[build->faces[i]]);
+    }
+
+    BvhNode node = {
+        .bounds = bounds,
+        .face_begin = begin,
+        .face_end = end,
+        .right_child = 0,
+    };
+
+    if (end - begin > BVH_LEAF_FACES) {
+        Vec3f extent = centroid_bounds.max - centroid_bounds.min;
+        int axis = 0;
+        if (extent.y > extent.x) axis = 1;
+        if (extent.z > axis_value(extent, axis)) axis = 2;
+
+        // All centroids in one point can't be split
+        if (axis_value(extent, axis) > 0.f) {
+            std::vector<Vec3f> *centroids = &build->centroids;
+            std::stable_sort(
+                build->faces.begin() + begin,
+                build->faces.begin() + end,
+                [centroids, axis](int a, int b) {
+                    return axis_value((*centroids)[a], axis) < axis_value((*centroids)[b], axis);
+                }
+            );
+
+            int middle = begin + (end - begin) / 2;
+
+            // Put the faces back in their previous order on both sides
+            std::sort(build->faces.begin() + begin, build->faces.begin() + middle);
+            std::sort(build->faces.begin() + middle, build->faces.begin() + end);
+
+            bvh_build_node(build, shape, begin, middle);
+            node.right_child = bvh_build_node(build, shape, middle, end);
+        }
+    }
+
+    build->nodes[node_idx] = node;
+
+    return node_idx;
+}
+
+void bvh_build(TinyMesh *mesh, PS_MeshShape *shape) {
+    shape->bvh_nodes = nullptr;
+    shape->bvh_node_count = 0;
+
+    if (shape->face_count == 0) {
+        return;
+    }
+
+    BvhBuild build = {
+        .mesh = mesh,
+        .faces = std::vector<int>(shape->face_count),
+        .centroids = std::vector<Vec3f>(shape->face_count),
+        .nodes = {},
+    };
+
+    for (int i = 0; i < shape->face_count; i++) {
+        build.faces[i] = i;
+        build.centroids[i] = face_centroid(mesh, &shape->faces[i]);
+    }
+
+    bvh_build_node(&build, shape, 0, shape->face_count);
+
+    std::vector<TinyFace> faces(shape->faces, shape->faces + shape->face_count);
+    for (int i = 0; i < shape->face_count; i++) {
+        shape->faces[i] = faces[build.faces[i]];
+    }
+
+    shape->bvh_node_count = build.nodes.size();
+    shape->bvh_nodes = (BvhNode *)malloc(build.nodes.size() * sizeof(BvhNode));
+    std::copy(build.nodes.begin(), build.nodes.end(), shape->bvh_nodes);
+}
+
+static void ranges_add(std::vector<FaceRange> *ranges, int begin, int end) {
+    if (!ranges->empty() && ranges->back().end == begin) {
+        ranges->back().end = end;
+        return;
+    }
+
+    ranges->push_back({ begin, end });
+}
+
+void bvh_frustum_ranges(PS_MeshShape *shape, Frustum *frustum, std::vector<FaceRange> *ranges) {
+    if (shape->bvh_node_count == 0) {
+        return;
+    }
+
+    // Depth first, so ranges come out in face order
+    int stack[64];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+        BvhNode *node = &shape->bvh_nodes[stack[--stack_size]];
+        FrustumTest test = frustum_test_box(frustum, &node->bounds);
+
+        if (test == FRUSTUM_OUTSIDE) {
+            continue;
+        }
+
+        // Everything below is visible as well
+        if (test == FRUSTUM_INSIDE || node->right_child == 0) {
+            ranges_add(ranges, node->face_begin, node->face_end);
+            continue;
+        }
+
+        int node_idx = node - shape->bvh_nodes;
+        stack[stack_size++] = node->right_child;
+        stack[stack_size++] = node_idx + 1;
+    }
+}
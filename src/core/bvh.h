@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+#include "clipping.h"
+#include "mesh.h"
+
+// Leaves hold at most this many faces, the most a meshlet can have
+#define BVH_LEAF_FACES 124
+
+// Nodes are stored depth first: the left child of an inner node comes right
+// after it, the right child at `right_child`. Every node covers a
+// contiguous range of the shape's faces, the union of its children's.
+struct BvhNode {
+    BoundingBox bounds;
+
+    int face_begin;
+    int face_end;
+
+    // 0 for leaves
+    int right_child;
+};
+
+// Builds the shape's BVH with median splits along the longest axis of the
+// face centroids. Reorders the faces so every node's are contiguous; the
+// split is stable, so faces in a leaf keep their relative order.
+void bvh_build(TinyMesh *mesh, PS_MeshShape *shape);
+
+// Appends the face ranges of the nodes that are at least partially inside
+// the frustum. Ranges that follow each other are merged.
+void bvh_frustum_ranges(PS_MeshShape *shape, Frustum *frustum, std::vector<FaceRange> *ranges);
@@ -1,104 +1,198 @@
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cmath>
+
 #include "clipping.h"
 
-void init_clipping_planes_orthographic(
-    Plane planes[6],
-    float left,
-    float right,
-    float top,
-    float bottom,
-    float z_near,
-    float z_far
-) {
-    Vec3f origin = {};
-    Vec3f vec_top = { 0, -1, 0 };
-    Vec3f vec_bottom = { 0, 1, 0 };
-    Vec3f vec_left = { 1, 0, 0 };
-    Vec3f vec_right = { -1, 0, 0 };
+GuardBand clip_guard_band(int width, int height, int pixels, int max_coordinate) {
+    float half_width = width / 2;
+    float half_height = height / 2;
+
+    // A pixel short of the limit, snapping rounds to the nearest subpixel.
+    // The limit is measured from the center of the viewport.
+    float max_x = max_coordinate - 1;
+    float max_y = max_coordinate - 1;
+
+    // Viewports past the limit get a band inside of the view volume, which
+    // cuts off what can't be rasterized. A limit of a pixel or less leaves
+    // nothing.
+    return {
+        .x = std::max(0.f, std::min(half_width + pixels, max_x)) / half_width,
+        .y = std::max(0.f, std::min(half_height + pixels, max_y)) / half_height,
+    };
+}
 
-    // The clipping planes face outward
-    planes[CLIPPING_PLANE_LEFT] = { .position = { left, 0, 0 }, .normal = { -1, 0, 0 } };
-    planes[CLIPPING_PLANE_RIGHT] = { .position = Vec3f{ right, 0, 0 }, .normal = { 1, 0, 0 } };
+Frustum frustum_from_matrix(Matrix4 *mat) {
+    Vec4f row_x = { mat->m0, mat->m4, mat->m8, mat->m12 };
+    Vec4f row_y = { mat->m1, mat->m5, mat->m9, mat->m13 };
+    Vec4f row_z = { mat->m2, mat->m6, mat->m10, mat->m14 };
+    Vec4f row_w = { mat->m3, mat->m7, mat->m11, mat->m15 };
 
-    planes[CLIPPING_PLANE_TOP] = { .position = { 0, top, 0 }, .normal = { 0, 1, 0 } };
-    planes[CLIPPING_PLANE_BOTTOM] = { .position = { 0, bottom, 0 }, .normal = { 0, -1, 0 } };
+    Frustum frustum;
+    frustum.planes[CLIPPING_PLANE_LEFT] = row_w + row_x;
+    frustum.planes[CLIPPING_PLANE_RIGHT] = row_w - row_x;
+    frustum.planes[CLIPPING_PLANE_TOP] = row_w - row_y;
+    frustum.planes[CLIPPING_PLANE_BOTTOM] = row_w + row_y;
+    frustum.planes[CLIPPING_PLANE_NEAR] = row_w - row_z;
+    frustum.planes[CLIPPING_PLANE_FAR] = row_w + row_z;
 
-    planes[CLIPPING_PLANE_NEAR] = { .position = { 0.0f, 0.0f, z_near }, .normal = { 0.0f, 0.0f, -1.0f} };
-    planes[CLIPPING_PLANE_FAR] = { .position = { 0.0f, 0.0f, z_far }, .normal = { 0.0f, 0.0f, 1.0f} };
+    for (int i = 0; i < 6; i++) {
+        Vec4f *plane = &frustum.planes[i];
+        float length = sqrtf(plane->x * plane->x + plane->y * plane->y + plane->z * plane->z);
+
+        if (length > 0.f) {
+            *plane = *plane * (1.f / length);
+        }
+    }
+
+    return frustum;
 }
 
-// Pass camera and build plane based on camera type?
-void init_clipping_planes_perspective(
-    Plane planes[6],
-    float fov_horizontal,
-    float fov_vertical,
-    float z_near,
-    float z_far
-) {
-    float half_fov_v = fov_vertical / 2;
-    float half_fov_h = fov_horizontal / 2;
+bool frustum_test_bounds(Frustum *frustum, BoundingBox *box, BoundingSphere *sphere) {
+    for (int i = 0; i < 6; i++) {
+        Vec4f plane = frustum->planes[i];
 
-    Vec3f origin = {};
+        float center_distance =
+            plane.x * sphere->center.x +
+            plane.y * sphere->center.y +
+            plane.z * sphere->center.z +
+            plane.w;
 
-    planes[CLIPPING_PLANE_LEFT] = { .position = origin, .normal = { cos(half_fov_h), 0, -sin(half_fov_h) } };
-    planes[CLIPPING_PLANE_RIGHT] = { .position = origin, .normal = { -cos(half_fov_h), 0, -sin(half_fov_h) } };
+        if (center_distance < -sphere->radius) {
+            return false;
+        }
 
-    planes[CLIPPING_PLANE_TOP] = { .position = origin, .normal = { 0, -cos(half_fov_v), -sin(half_fov_v) } };
-    planes[CLIPPING_PLANE_BOTTOM] = { .position = origin, .normal = { 0, cos(half_fov_v), -sin(half_fov_v) } };
+        // The box corner furthest along the plane normal
+        float corner_distance =
+            plane.x * (plane.x > 0 ? box->max.x : box->min.x) +
+            plane.y * (plane.y > 0 ? box->max.y : box->min.y) +
+            plane.z * (plane.z > 0 ? box->max.z : box->min.z) +
+            plane.w;
 
-    planes[CLIPPING_PLANE_NEAR] = { .position = { 0.0f, 0.0f, z_near }, .normal = { 0.0f, 0.0f, -1.0f} };
-    planes[CLIPPING_PLANE_FAR] = { .position = { 0.0f, 0.0f, z_far }, .normal = { 0.0f, 0.0f, 1.0f} };
+        if (corner_distance < 0.f) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-static void clip_polygon_against_plane(TinyPolygon *polygon, Plane plane) {
-    TinyPolygon out;
-    size_t size = 0;
+bool frustum_test_sphere(Frustum *frustum, BoundingSphere *sphere) {
+    for (int i = 0; i < 6; i++) {
+        Vec4f plane = frustum->planes[i];
+
+        float center_distance =
+            plane.x * sphere->center.x +
+            plane.y * sphere->center.y +
+            plane.z * sphere->center.z +
+            plane.w;
+
+        if (center_distance < -sphere->radius) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+FrustumTest frustum_test_box(Frustum *frustum, BoundingBox *box) {
+    FrustumTest result = FRUSTUM_INSIDE;
+
+    for (int i = 0; i < 6; i++) {
+        Vec4f plane = frustum->planes[i];
+
+        // The box corners furthest along the plane normal and against it
+        float positive_distance =
+            plane.x * (plane.x > 0 ? box->max.x : box->min.x) +
+            plane.y * (plane.y > 0 ? box->max.y : box->min.y) +
+            plane.z * (plane.z > 0 ? box->max.z : box->min.z) +
+            plane.w;
+
+        if (positive_distance < 0.f) {
+            return FRUSTUM_OUTSIDE;
+        }
+
+        float negative_distance =
+            plane.x * (plane.x > 0 ? box->min.x : box->max.x) +
+            plane.y * (plane.y > 0 ? box->min.y : box->max.y) +
+            plane.z * (plane.z > 0 ? box->min.z : box->max.z) +
+            plane.w;
+
+        if (negative_distance < 0.f) {
+            result = FRUSTUM_INTERSECTING;
+        }
+    }
+
+    return result;
+}
+
+// Signed distance to the plane in clip space, positive inside
+static float plane_distance(Vec4f position, int plane, GuardBand *guard_band) {
+    switch (plane) {
+        case CLIPPING_PLANE_LEFT: return guard_band->x * position.w + position.x;
+        case CLIPPING_PLANE_RIGHT: return guard_band->x * position.w - position.x;
+        case CLIPPING_PLANE_TOP: return guard_band->y * position.w - position.y;
+        case CLIPPING_PLANE_BOTTOM: return guard_band->y * position.w + position.y;
+        case CLIPPING_PLANE_NEAR: return position.w - position.z;
+        default: return position.w + position.z;
+    }
+}
 
-    Vec3f plane_point = plane.position;
-    Vec3f plane_normal = plane.normal;
+static void clip_polygon_against_plane(
+    TinyPolygon *polygon,
+    TinyPolygon *out,
+    int plane,
+    GuardBand *guard_band
+) {
+    size_t size = 0;
 
     Vec4f prev_vertex = polygon->vertices[polygon->vertex_count - 1].position;
     Vec3f prev_normal = polygon->vertices[polygon->vertex_count - 1].normal;
     Vec2f prev_texcoords = polygon->vertices[polygon->vertex_count - 1].texcoords;
+    float *prev_custom = polygon->vertices[polygon->vertex_count - 1].custom;
 
-    float dot_prev = Vec3f::dot(vec3_from_vec4(prev_vertex) - plane_point, plane_normal);
+    float dot_prev = plane_distance(prev_vertex, plane, guard_band);
     float dot_current;
 
     for (size_t i = 0; i < polygon->vertex_count; i++) {
         Vec4f curr_vertex = polygon->vertices[i].position;
         Vec3f curr_normal = polygon->vertices[i].normal;
         Vec2f curr_texcoords = polygon->vertices[i].texcoords;
+        float *curr_custom = polygon->vertices[i].custom;
 
-        dot_current = Vec3f::dot(vec3_from_vec4(curr_vertex) - plane_point, plane_normal);
+        dot_current = plane_distance(curr_vertex, plane, guard_band);
 
         // SECTION: Intersection point
-        if (dot_current * dot_prev < 0) {
-            // I = dotQ_1 + t(dotQ_2 - dotQ_1)
+        if ((dot_current >= 0) != (dot_prev >= 0)) {
+            // I = dotQ_1 + t(dotQ_2 - dotQ_1), attributes are linear in
+            // clip space so they can be interpolated the same way
             float t = dot_prev / (dot_prev - dot_current);
 
-            out.vertices[size++] = {
+            TinyVertex *intersection = &out->vertices[size++];
+            *intersection = {
                 (curr_vertex - prev_vertex) * t + prev_vertex,
                 (curr_normal - prev_normal) * t + prev_normal,
                 (curr_texcoords - prev_texcoords) * t + prev_texcoords,
             };
+            for (int k = 0; k < VARYING_CUSTOM_SLOTS; k++) {
+                intersection->custom[k] = (curr_custom[k] - prev_custom[k]) * t + prev_custom[k];
+            }
         }
         // SECTION_END
 
-        if (dot_current > 0) { // current vertex happens to be inside
-            out.vertices[size++] = {
-                curr_vertex,
-                curr_normal,
-                curr_texcoords
-            };
+        if (dot_current >= 0) { // current vertex happens to be inside
+            out->vertices[size++] = polygon->vertices[i];
         }
 
         dot_prev = dot_current;
         prev_vertex = curr_vertex;
         prev_normal = curr_normal;
         prev_texcoords = curr_texcoords;
+        prev_custom = curr_custom;
     }
 
-    *polygon = out;
-    polygon->vertex_count = size;
+    out->vertex_count = size;
 }
 
 void triangulate_polygon(
@@ -106,7 +200,10 @@ void triangulate_polygon(
     TinyTriangle *triangles,
     size_t *triangle_count
 ) {
-    if (polygon->vertex_count == 0) {
+    // Clipping can leave a point or an edge behind when the polygon only
+    // touches a plane
+    if (polygon->vertex_count < 3) {
+        *triangle_count = 0;
         return;
     }
 
@@ -148,12 +245,120 @@ TinyPolygon polygon_from_triangle(
     };
 }
 
-void clip_polygon(TinyPolygon *polygon, Plane clipping_planes[6]) {
-    clip_polygon_against_plane(polygon, clipping_planes[CLIPPING_PLANE_LEFT]);
-    clip_polygon_against_plane(polygon, clipping_planes[CLIPPING_PLANE_RIGHT]);
-    clip_polygon_against_plane(polygon, clipping_planes[CLIPPING_PLANE_TOP]);
-    clip_polygon_against_plane(polygon, clipping_planes[CLIPPING_PLANE_BOTTOM]);
-    clip_polygon_against_plane(polygon, clipping_planes[CLIPPING_PLANE_NEAR]);
-    clip_polygon_against_plane(polygon, clipping_planes[CLIPPING_PLANE_FAR]);
+void clip_polygon(TinyPolygon *polygon, int outcodes, GuardBand *guard_band) {
+    GuardBand view_volume = { 1.f, 1.f };
+    if (guard_band == nullptr) {
+        guard_band = &view_volume;
+    }
+
+    // Planes are clipped against back and forth between the polygon and
+    // this, so it's copied at most once
+    TinyPolygon scratch;
+    TinyPolygon *in = polygon;
+    TinyPolygon *out = &scratch;
+
+    for (int plane = CLIPPING_PLANE_LEFT; plane <= CLIPPING_PLANE_FAR; plane++) {
+        if (!(outcodes & (1 << plane)) || in->vertex_count == 0) {
+            continue;
+        }
+
+        clip_polygon_against_plane(in, out, plane, guard_band);
+
+        TinyPolygon *clipped = out;
+        out = in;
+        in = clipped;
+    }
+
+    if (in != polygon) {
+        for (size_t i = 0; i < in->vertex_count; i++) {
+            polygon->vertices[i] = in->vertices[i];
+        }
+        polygon->vertex_count = in->vertex_count;
+    }
+}
+
+static TinyPolygon test_polygon(Vec4f a, Vec4f b, Vec4f c) {
+    return polygon_from_triangle(
+        a, b, c,
+        { 0, 0 }, { 1, 0 }, { 0, 1 },
+        { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 }
+    );
+}
+
+TEST_CASE("clip_polygon cuts a triangle straddling the near plane") {
+    // The second vertex is past the near plane, z > w
+    TinyPolygon polygon = test_polygon({ 0, 0, 0.5f, 1 }, { 0.5f, 0, 2, 1 }, { 0, 0.5f, 0.5f, 1 });
+
+    clip_polygon(&polygon, CLIP_OUTCODE_NEAR);
+
+    REQUIRE(polygon.vertex_count == 4);
+
+    int on_plane = 0;
+    for (size_t i = 0; i < polygon.vertex_count; i++) {
+        Vec4f position = polygon.vertices[i].position;
+        CHECK(position.z <= position.w + 1e-6f);
+        on_plane += fabsf(position.z - position.w) <= 1e-6f;
+    }
+    CHECK(on_plane == 2);
+
+    // A third of the way from the first vertex to the second, attributes
+    // included
+    TinyVertex *cut = &polygon.vertices[1];
+    CHECK(cut->position.x == doctest::Approx(0.5f / 3));
+    CHECK(cut->texcoords.x == doctest::Approx(1.f / 3));
+
+    TinyTriangle triangles[POLYGON_MAX_TRIANGLES];
+    size_t triangle_count = 0;
+    triangulate_polygon(&polygon, triangles, &triangle_count);
+    CHECK(triangle_count == 2);
+}
+
+TEST_CASE("clip_polygon removes a triangle outside a plane") {
+    TinyPolygon polygon = test_polygon({ -3, 0, 0, 1 }, { -2, 1, 0, 1 }, { -4, -1, 0, 1 });
+
+    clip_polygon(&polygon, CLIP_OUTCODE_VIEW_VOLUME);
+    CHECK(polygon.vertex_count == 0);
+
+    TinyTriangle triangles[POLYGON_MAX_TRIANGLES];
+    size_t triangle_count = 1;
+    triangulate_polygon(&polygon, triangles, &triangle_count);
+    CHECK(triangle_count == 0);
 }
 
+TEST_CASE("clip_polygon leaves triangles inside the guard band alone") {
+    // Past the right side of the view volume, but inside the band
+    Vec4f positions[3] = { { 0, 0, 0, 1 }, { 1.3f, 0.2f, 0, 1 }, { 0.4f, 1.2f, 0, 1 } };
+    GuardBand guard_band = { 1.5f, 1.5f };
+
+    TinyPolygon polygon = test_polygon(positions[0], positions[1], positions[2]);
+    clip_polygon(&polygon, CLIP_OUTCODE_SIDES, &guard_band);
+
+    REQUIRE(polygon.vertex_count == 3);
+    for (int i = 0; i < 3; i++) {
+        Vec4f position = polygon.vertices[i].position;
+        CHECK(position.x == positions[i].x);
+        CHECK(position.y == positions[i].y);
+        CHECK(position.z == positions[i].z);
+        CHECK(position.w == positions[i].w);
+    }
+
+    // Without the band, the view volume cuts it
+    polygon = test_polygon(positions[0], positions[1], positions[2]);
+    clip_polygon(&polygon, CLIP_OUTCODE_SIDES);
+    CHECK(polygon.vertex_count > 3);
+}
+
+TEST_CASE("clip_guard_band stays within the rasterizer's range") {
+    GuardBand band = clip_guard_band(320, 240, 64, 2048);
+    CHECK(band.x == doctest::Approx(224.f / 160));
+    CHECK(band.y == doctest::Approx(184.f / 120));
+
+    // Too wide for the limit, the band moves inside of the view volume
+    band = clip_guard_band(8000, 240, 64, 2048);
+    CHECK(band.x == doctest::Approx(2047.f / 4000));
+    CHECK(band.y == doctest::Approx(184.f / 120));
+
+    band = clip_guard_band(320, 240, 64, 1);
+    CHECK(band.x == 0.f);
+    CHECK(band.y == 0.f);
+}
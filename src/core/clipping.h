@@ -1,6 +1,7 @@
 #ifndef __CLIPPING__
 #define __CLIPPING__
 
+#include "matrix.h"
 #include "tiny_math.h"
 #include "mesh.h"
 
@@ -16,28 +17,66 @@ enum PlaneType {
     CLIPPING_PLANE_FAR,
 };
 
-struct Plane {
-    Vec3f position;
-    Vec3f normal;
+// Clip space outcodes, a bit for every plane of the view volume
+// -w <= x, y, z <= w a vertex is outside of. The near plane is at z = w.
+enum ClipOutcode {
+    CLIP_OUTCODE_LEFT = 1 << CLIPPING_PLANE_LEFT,     // x < -w
+    CLIP_OUTCODE_RIGHT = 1 << CLIPPING_PLANE_RIGHT,   // x > w
+    CLIP_OUTCODE_TOP = 1 << CLIPPING_PLANE_TOP,       // y > w
+    CLIP_OUTCODE_BOTTOM = 1 << CLIPPING_PLANE_BOTTOM, // y < -w
+    CLIP_OUTCODE_NEAR = 1 << CLIPPING_PLANE_NEAR,     // z > w
+    CLIP_OUTCODE_FAR = 1 << CLIPPING_PLANE_FAR,       // z < -w
+
+    // Outside the guard band on x or y. Only faces with a vertex out there
+    // are clipped against the side planes, the rasterizer's screen bounds
+    // take care of the rest.
+    CLIP_OUTCODE_GUARD_BAND = 1 << 6,
 };
 
-void init_clipping_planes_perspective(
-    Plane planes[6],
-    float fov_horizontal,
-    float fov_vertical,
-    float z_near,
-    float z_far
-);
+#define CLIP_OUTCODE_VIEW_VOLUME 0x3f
+#define CLIP_OUTCODE_SIDES (CLIP_OUTCODE_LEFT | CLIP_OUTCODE_RIGHT | CLIP_OUTCODE_TOP | CLIP_OUTCODE_BOTTOM)
 
-void init_clipping_planes_orthographic(
-    Plane planes[6],
-    float left,
-    float right,
-    float top,
-    float bottom,
-    float z_near,
-    float z_far
-);
+// Half extents of the guard band in NDC, the view volume is 1 x 1
+struct GuardBand {
+    float x;
+    float y;
+};
+
+// Guard band reaching `pixels` past every edge of a width x height viewport,
+// shrunk so screen coordinates inside of it stay within max_coordinate
+// pixels of the viewport's center. That can put it inside of the view
+// volume, so faces outside of the band have to be clipped against all side
+// planes.
+GuardBand clip_guard_band(int width, int height, int pixels, int max_coordinate);
+
+// The planes of the view volume in the space a matrix maps to clip space
+// from, indexed by PlaneType. Normalized, (a, b, c) points inside and
+// a * x + b * y + c * z + d is the distance.
+struct Frustum {
+    Vec4f planes[6];
+};
+
+// Gribb and Hartmann: extracts the planes from the rows of `mat`. With the
+// model to clip space matrix they come out in model space, so bounds can be
+// tested without transforming them.
+Frustum frustum_from_matrix(Matrix4 *mat);
+
+// False when the bounds are entirely outside one of the planes. Can let
+// some bounds near the frustum's corners through.
+bool frustum_test_bounds(Frustum *frustum, BoundingBox *box, BoundingSphere *sphere);
+
+// False when the sphere is entirely outside one of the planes
+bool frustum_test_sphere(Frustum *frustum, BoundingSphere *sphere);
+
+enum FrustumTest {
+    FRUSTUM_OUTSIDE,
+    FRUSTUM_INTERSECTING,
+    FRUSTUM_INSIDE,
+};
+
+// Like frustum_test_bounds for the box alone, also telling boxes entirely
+// inside all planes apart
+FrustumTest frustum_test_box(Frustum *frustum, BoundingBox *box);
 
 struct TinyPolygon {
     TinyVertex vertices[POLYGON_MAX_VERTICES];
@@ -49,7 +88,10 @@ TinyPolygon polygon_from_triangle(
     Vec2f a_uv, Vec2f b_uv, Vec2f c_uv,
     Vec3f a_norm, Vec3f b_norm, Vec3f c_norm
 );
-void clip_polygon(TinyPolygon *p, Plane planes[6]);
+// Clips a polygon in clip space against the planes whose ClipOutcode bits
+// are set in `outcodes`. Side planes are moved out to the guard band when
+// one is given.
+void clip_polygon(TinyPolygon *p, int outcodes, GuardBand *guard_band = nullptr);
 void triangulate_polygon(TinyPolygon *p, TinyTriangle *triangles, size_t *triangles_count);
 
 #endif
@@ -0,0 +1,16 @@
+#include "cpu_features.h"
+
+static bool cpu_detect_avx2() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+bool cpu_supports_avx2() {
+    static bool supported = cpu_detect_avx2();
+
+    return supported;
+}
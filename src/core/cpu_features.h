@@ -0,0 +1,5 @@
+#pragma once
+
+// Whether the CPU runs AVX2 code. Detected on the first call, so every
+// kernel selection gets the same answer. Always false off x86-64.
+bool cpu_supports_avx2();
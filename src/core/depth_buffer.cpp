@@ -1,4 +1,5 @@
 #include "depth_buffer.h"
+#include <algorithm>
 #include <stdlib.h>
 
 DepthBuffer* depth_buffer_create(uint16_t width, uint16_t height, float default_value) {
@@ -19,16 +20,26 @@ DepthBuffer* depth_buffer_create(uint16_t width, uint16_t height, float default_
         return nullptr;
     }
 
-    for (uint32_t i = 0; i < buffer->size; i++) {
-        buffer->data[i] = default_value;
+    buffer->hiz_width = (width + DEPTH_HIZ_CELL_SIZE - 1) / DEPTH_HIZ_CELL_SIZE;
+    buffer->hiz_height = (height + DEPTH_HIZ_CELL_SIZE - 1) / DEPTH_HIZ_CELL_SIZE;
+    buffer->hiz = (float*)malloc(buffer->hiz_width * buffer->hiz_height * sizeof(float));
+
+    if (!buffer->hiz) {
+        free(buffer->data);
+        free(buffer);
+        return nullptr;
     }
 
+    depth_buffer_clear(buffer, default_value);
+
     return buffer;
 }
 
 void depth_buffer_destroy(DepthBuffer *d_buffer) {
     free(d_buffer->data);
     d_buffer->data = nullptr;
+    free(d_buffer->hiz);
+    d_buffer->hiz = nullptr;
 }
 
 
@@ -65,6 +76,27 @@ void depth_buffer_clear(DepthBuffer *d_buffer, float value) {
     for (size_t i = 0; i < d_buffer->size; i++) {
         d_buffer->data[i] = value;
     }
+
+    for (size_t i = 0; i < (size_t)d_buffer->hiz_width * d_buffer->hiz_height; i++) {
+        d_buffer->hiz[i] = value;
+    }
 };
+
+void depth_buffer_hiz_update(DepthBuffer *d_buffer, uint16_t cell_x, uint16_t cell_y) {
+    int x_start = cell_x * DEPTH_HIZ_CELL_SIZE;
+    int y_start = cell_y * DEPTH_HIZ_CELL_SIZE;
+    int x_end = std::min((int)d_buffer->width, x_start + DEPTH_HIZ_CELL_SIZE);
+    int y_end = std::min((int)d_buffer->height, y_start + DEPTH_HIZ_CELL_SIZE);
+
+    float farthest = d_buffer->data[y_start * d_buffer->width + x_start];
+    for (int y = y_start; y < y_end; y++) {
+        float *row = d_buffer->data + y * d_buffer->width;
+        for (int x = x_start; x < x_end; x++) {
+            farthest = std::min(farthest, row[x]);
+        }
+    }
+
+    d_buffer->hiz[d_buffer->hiz_width * cell_y + cell_x] = farthest;
+}
 // void generate_depth_image_data(DepthBuffer *d_buffer, ColorBuffer *c_buffer) {};
 
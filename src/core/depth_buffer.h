@@ -4,11 +4,21 @@
 #include <cstddef>
 #include <stdint.h>
 
+// Side of the square cells of the coarse (Hi-Z) depth level
+#define DEPTH_HIZ_CELL_SIZE 8
+
 struct DepthBuffer {
     uint16_t width;
     uint16_t height;
     float *data = nullptr;
     size_t size;
+
+    // Farthest (smallest) depth of every cell. Depth only ever grows until
+    // the next clear, so a stale value is still a safe bound: anything
+    // farther than it is hidden everywhere in the cell.
+    float *hiz = nullptr;
+    uint16_t hiz_width;
+    uint16_t hiz_height;
 };
 
 DepthBuffer* depth_buffer_create(uint16_t width, uint16_t height, float default_value);
@@ -21,4 +31,11 @@ void depth_buffer_set(DepthBuffer *d_buffer, uint16_t x, uint16_t y, float value
 void depth_buffer_set(DepthBuffer *d_buffer, uint16_t i, float value);
 
 void depth_buffer_clear(DepthBuffer *d_buffer, float value);
+
+inline float depth_buffer_hiz_get(DepthBuffer *d_buffer, uint16_t cell_x, uint16_t cell_y) {
+    return d_buffer->hiz[d_buffer->hiz_width * cell_y + cell_x];
+}
+
+// Recomputes the bound of a cell from its pixels, after they were written
+void depth_buffer_hiz_update(DepthBuffer *d_buffer, uint16_t cell_x, uint16_t cell_y);
 // void generate_depth_image_data(DepthBuffer *d_buffer, ColorBuffer *c_buffer);
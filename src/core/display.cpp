@@ -1,11 +1,13 @@
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <vector>
 
 #include "color_buffer.h"
 #include "display.h"
+#include "raster.h"
 #include "raylib.h"
 #include "raymath.h"
 #include "tiny_math.h"
@@ -79,24 +81,6 @@ static void triangle_bb(Vec2f vertices[3], int boundaries[4], int screen_width,
     boundaries[3] = std::min(screen_height - 1, y_end);
 }
 
-inline static void barycentric_coords(Vec2f vertices[3], Vec2f p, float *alpha, float *beta, float *gamma) {
-    // Formula: P = A + w1 * (B - A) + w2 * (C - A)
-    //          P = A + u * vAB + vAC
-    Vec2f vAB = vertices[1] - vertices[0];
-    Vec2f vAC = vertices[2] - vertices[0];
-    Vec2f vAP = p - vertices[0];
-
-    float area_abc = vAB.x * vAC.y - vAC.x * vAB.y;
-
-    *beta =  (float)(vAP.x * vAC.y - vAC.x * vAP.y) / area_abc;
-    *gamma = (float)(vAB.x * vAP.y - vAP.x * vAB.y) / area_abc;
-    *alpha = 1.0f - *beta - *gamma;
-}
-
-inline static float apply_barycentric(float a, float b, float c, float alpha, float beta, float gamma) {
-    return alpha * a + beta * b + gamma * c;
-}
-
 static Color sample_color_from_texture(
     Color* texture_data,
     Image *texture,
@@ -138,46 +122,18 @@ static Color sample_color_from_texture(
     }
 }
 
-inline static Vec3f calculate_fragment_normal(
-    TinyTriangle * triangle,
-    float w_inverse0,
-    float w_inverse1,
-    float w_inverse2,
-    float w_inverse,
-    float alpha,
-    float beta,
-    float gamma
-) {
-    Vec3f fragment_normal = {};
-    fragment_normal.x = apply_barycentric(
-        triangle->vertices[0].normal.x * w_inverse0,
-        triangle->vertices[1].normal.x * w_inverse1,
-        triangle->vertices[2].normal.x * w_inverse2,
-        alpha, beta, gamma);
-    fragment_normal.y = apply_barycentric(
-        triangle->vertices[0].normal.y * w_inverse0,
-        triangle->vertices[1].normal.y * w_inverse1,
-        triangle->vertices[2].normal.y * w_inverse2,
-        alpha, beta, gamma);
-    fragment_normal.z = apply_barycentric(
-        triangle->vertices[0].normal.z * w_inverse0,
-        triangle->vertices[1].normal.z * w_inverse1,
-        triangle->vertices[2].normal.z * w_inverse2,
-        alpha, beta, gamma);
-
-    fragment_normal.x /= w_inverse;
-    fragment_normal.y /= w_inverse;
-    fragment_normal.z /= w_inverse;
-
-    return fragment_normal;
-}
-
 void depth_test(
     CameraType camera_type,
     ColorBuffer *color_buffer,
     DepthBuffer *depth_buffer,
     TinyTriangle *triangle,
-    FragmentShader fragment_shader
+    FragmentShader fragment_shader,
+    void *uniforms,
+    const int *scissor,
+    GBuffer *g_buffer,
+    uint32_t triangle_id,
+    VisibilityBuffer *visibility_buffer,
+    const TriangleEdges *setup_edges
 ) {
     int target_width = depth_buffer->width;
     int target_height = depth_buffer->height;
@@ -190,95 +146,124 @@ void depth_test(
     };
     triangle_bb(v_screen, boundaries, target_width, target_height);
 
-    Vec2f p; // Current pixel
-    float alpha, beta, gamma;
+    if (scissor != nullptr) {
+        boundaries[0] = std::max(boundaries[0], scissor[0]);
+        boundaries[1] = std::min(boundaries[1], scissor[1]);
+        boundaries[2] = std::max(boundaries[2], scissor[2]);
+        boundaries[3] = std::min(boundaries[3], scissor[3]);
+    }
 
-    float w_inverse0 = 1 / triangle->vertices[0].position.w;
-    float w_inverse1 = 1 / triangle->vertices[1].position.w;
-    float w_inverse2 = 1 / triangle->vertices[2].position.w;
+    if (boundaries[0] > boundaries[1] || boundaries[2] > boundaries[3]) {
+        return;
+    }
 
-    float depth_value;
-    float intensity = 1.0f;
+    TriangleEdges edges;
+    if (setup_edges != nullptr) {
+        edges = *setup_edges;
+    } else if (!triangle_edges_setup(v_screen, target_width, target_height, &edges)) {
+        return;
+    }
 
-    for (p.x = boundaries[0]; p.x <= boundaries[1]; p.x++) {
-        for (p.y = boundaries[2]; p.y <= boundaries[3]; p.y++) {
-            barycentric_coords(v_screen, {p.x, p.y}, &alpha, &beta, &gamma);
-
-            if (alpha >= 0 && beta >= 0 && gamma >= 0) {
-                auto w_inverse_interpl = apply_barycentric(
-                    w_inverse0,
-                    w_inverse1,
-                    w_inverse2,
-                    alpha, beta, gamma);
-
-                switch (camera_type) {
-                    case CameraType::ORTHOGRAPHIC:
-                        depth_value = apply_barycentric(
-                            triangle->vertices[0].position.z * w_inverse0,
-                            triangle->vertices[1].position.z * w_inverse1,
-                            triangle->vertices[2].position.z * w_inverse2,
-                            alpha, beta, gamma
-                        );
-                        break;
-                    case CameraType::PERSPECTIVE:
-                        depth_value = w_inverse_interpl;
-                        break;
-                }
+    // Depth is linear in screen space, so the triangle is nearest at one of
+    // its vertices. Blocks whose Hi-Z cell is already closer than that are
+    // hidden.
+    float nearest_depth = -INFINITY;
+    for (int i = 0; i < 3; i++) {
+        Vec4f *position = &triangle->vertices[i].position;
+        float depth = camera_type == CameraType::ORTHOGRAPHIC ?
+            position->z / position->w :
+            1 / position->w;
+        nearest_depth = std::max(nearest_depth, depth);
+    }
 
-                auto depth_buffer_value = *buffer_pixel_get(depth_buffer, p.x, p.y);
+    // Attributes are only set up once a block survives the Hi-Z test
+    bool attributes_ready = false;
+    FragmentContext ctx = {
+        .camera_type = camera_type,
+        .color_buffer = color_buffer,
+        .depth_buffer = depth_buffer,
+        .triangle = triangle,
+        .fragment_shader = fragment_shader,
+        .uniforms = uniforms,
+        .g_buffer = g_buffer,
+        .visibility_buffer = visibility_buffer,
+        .triangle_id = triangle_id,
+        .attributes = {},
+    };
 
-                if (depth_value < depth_buffer_value) {
-                    continue;
+    RasterTarget target = RASTER_TARGET_DEPTH;
+    if (visibility_buffer != nullptr) {
+        target = RASTER_TARGET_VISIBILITY;
+    } else if (g_buffer != nullptr) {
+        target = RASTER_TARGET_G_BUFFER;
+    } else if (fragment_shader != nullptr) {
+        target = RASTER_TARGET_COLOR;
+    }
+
+    // Specialized for the draw, so the pixel loop doesn't branch on any of it
+    RasterKernel kernel = raster_kernel(camera_type, target, fragment_shader);
+
+    // Edge functions are linear, so over a block each one is smallest and
+    // largest at two of its corners. These are the offsets from the block's
+    // top-left corner to them.
+    int32_t block_extent = RASTER_BLOCK_SIZE - 1;
+    int32_t e_min_offset[3];
+    int32_t e_max_offset[3];
+    for (int i = 0; i < 3; i++) {
+        int32_t dx = edges.edges[i].a * block_extent;
+        int32_t dy = edges.edges[i].b * block_extent;
+        e_min_offset[i] = std::min(0, dx) + std::min(0, dy);
+        e_max_offset[i] = std::max(0, dx) + std::max(0, dy);
+    }
+
+    // Blocks are aligned to the screen, so they line up with the tiles
+    int block_x_start = boundaries[0] & ~(RASTER_BLOCK_SIZE - 1);
+    int block_y_start = boundaries[2] & ~(RASTER_BLOCK_SIZE - 1);
+
+    int32_t e_block_row[3];
+    for (int i = 0; i < 3; i++) {
+        e_block_row[i] = edges.edges[i].at(block_x_start, block_y_start);
+    }
+
+    for (int block_y = block_y_start; block_y <= boundaries[3]; block_y += RASTER_BLOCK_SIZE) {
+        int32_t e_block[3] = { e_block_row[0], e_block_row[1], e_block_row[2] };
+
+        for (int block_x = block_x_start; block_x <= boundaries[1]; block_x += RASTER_BLOCK_SIZE) {
+            bool outside = false;
+            bool covered = true;
+
+            for (int i = 0; i < 3; i++) {
+                outside |= e_block[i] + e_max_offset[i] < 0;
+                covered &= e_block[i] + e_min_offset[i] >= 0;
+            }
+
+            int cell_x = block_x / RASTER_BLOCK_SIZE;
+            int cell_y = block_y / RASTER_BLOCK_SIZE;
+
+            if (!outside && nearest_depth >= depth_buffer_hiz_get(depth_buffer, cell_x, cell_y)) {
+                int x_start = std::max(block_x, boundaries[0]);
+                int x_end = std::min(block_x + RASTER_BLOCK_SIZE - 1, boundaries[1]);
+                int y_start = std::max(block_y, boundaries[2]);
+                int y_end = std::min(block_y + RASTER_BLOCK_SIZE - 1, boundaries[3]);
+
+                if (!attributes_ready) {
+                    triangle_attributes_setup(triangle, &edges, kernel.attributes, &ctx.attributes);
+                    attributes_ready = true;
                 }
 
-                // SECTION: Normals
-                // Calculate fragment normal vertor
-                Vec3f fragment_normal = calculate_fragment_normal(
-                    triangle,
-                    w_inverse0, w_inverse1, w_inverse2,
-                    w_inverse_interpl,
-                    alpha, beta, gamma
-                );
-                // SECTION_END
-
-                // SECTION: UVs
-                auto u = apply_barycentric(
-                    triangle->vertices[0].texcoords.x * w_inverse0,
-                    triangle->vertices[1].texcoords.x * w_inverse1,
-                    triangle->vertices[2].texcoords.x * w_inverse2,
-                    alpha, beta, gamma);
-
-                auto v = apply_barycentric(
-                    triangle->vertices[0].texcoords.y * w_inverse0,
-                    triangle->vertices[1].texcoords.y * w_inverse1,
-                    triangle->vertices[2].texcoords.y * w_inverse2,
-                    alpha, beta, gamma);
-
-                // these are from 0 to 1
-                u /= w_inverse_interpl;
-                v /= w_inverse_interpl;
-                // SECTION_END
-
-                if (fragment_shader) {
-                    FragmentData shader_data = {
-                        .depth = depth_value,
-                        .u = u,
-                        .v = v,
-                        .normal = fragment_normal
-                    };
-
-                    // This is nonsence. The only reason why I pass on struct twice
-                    // is that I don't know to create generic pointers yet, if such
-                    // thing exists. If not, well I need to find a way to pass
-                    // uniforms as a second argument here
-                    auto result = fragment_shader(&shader_data, &shader_data);
-
-                    color_buffer->set_pixel(p.x, p.y, result);
+                if (kernel.block(&ctx, &edges, x_start, x_end, y_start, y_end, !covered)) {
+                    depth_buffer_hiz_update(depth_buffer, cell_x, cell_y);
                 }
+            }
 
-                depth_buffer_set(depth_buffer, p.x, p.y, depth_value);
+            for (int i = 0; i < 3; i++) {
+                e_block[i] += edges.edges[i].a * RASTER_BLOCK_SIZE;
             }
         }
+
+        for (int i = 0; i < 3; i++) {
+            e_block_row[i] += edges.edges[i].b * RASTER_BLOCK_SIZE;
+        }
     }
 }
 
@@ -307,7 +292,6 @@ void draw_triangle(
 
     float u, v; // Stores interpolated values
 
-    float alpha, beta, gamma;
     Color color = BLACK;
     Color *data = diffuse_texture == nullptr ? nullptr : (Color *)diffuse_texture->data;
 
@@ -319,37 +303,46 @@ void draw_triangle(
 
     triangle_bb(v_screen, boundaries, screen_width, screen_height);
 
-    float w_inverse0 = 1 / triangle->vertices[0].position.w;
-    float w_inverse1 = 1 / triangle->vertices[1].position.w;
-    float w_inverse2 = 1 / triangle->vertices[2].position.w;
+    TriangleEdges edges;
+    if (!triangle_edges_setup(v_screen, screen_width, screen_height, &edges)) {
+        return;
+    }
+
+    TriangleAttributes attributes;
+    triangle_attributes_setup(triangle, &edges, RASTER_ATTRIBUTES_ALL, &attributes);
+    AttributePlane *planes = attributes.planes;
+
     float w_inverse_interpl; // Holds depth of a pixel
 
     float intensity = 1.0f;
 
-    for (p.x = boundaries[0]; p.x <= boundaries[1]; p.x++) {
-        for (p.y = boundaries[2]; p.y <= boundaries[3]; p.y++) {
-            barycentric_coords(v_screen, {p.x, p.y}, &alpha, &beta, &gamma);
+    // Flags don't change during a draw, so they're read once
+    bool use_shading = renderer_state->flags[USE_SHADING];
+    bool use_z_buffer_check = renderer_state == nullptr ? false : renderer_state->flags[USE_Z_BUFFER];
+    bool use_face_normals = renderer_state->flags[RenderingFlags::USE_FACE_NORMALS];
+    bool draw_depth_buffer = renderer_state->flags[RenderingFlags::DRAW_DEPTH_BUFFER];
+
+    // Edge values at the top-left corner of the bounding box. From here on
+    // they are only stepped: +a for each pixel in a row, +b for each row.
+    int32_t e_row[3];
+    for (int i = 0; i < 3; i++) {
+        e_row[i] = edges.edges[i].at(boundaries[0], boundaries[2]);
+    }
+
+    for (p.y = boundaries[2]; p.y <= boundaries[3]; p.y++) {
+        int32_t e0 = e_row[0];
+        int32_t e1 = e_row[1];
+        int32_t e2 = e_row[2];
 
-            if (alpha >= 0 && beta >= 0 && gamma >= 0) {
-                w_inverse_interpl = apply_barycentric(
-                    w_inverse0,
-                    w_inverse1,
-                    w_inverse2,
-                    alpha, beta, gamma);
+        for (p.x = boundaries[0]; p.x <= boundaries[1]; p.x++,
+                e0 += edges.edges[0].a, e1 += edges.edges[1].a, e2 += edges.edges[2].a) {
+            if (e0 >= 0 && e1 >= 0 && e2 >= 0) {
+                w_inverse_interpl = planes[RASTER_ATTRIBUTE_W_INVERSE].at(p.x, p.y);
 
                 if (diffuse_texture != nullptr) {
                     // UV Interpolation of u/w and v/w
-                    u = apply_barycentric(
-                        triangle->vertices[0].texcoords.x * w_inverse0,
-                        triangle->vertices[1].texcoords.x * w_inverse1,
-                        triangle->vertices[2].texcoords.x * w_inverse2,
-                        alpha, beta, gamma);
-
-                    v = apply_barycentric(
-                        triangle->vertices[0].texcoords.y * w_inverse0,
-                        triangle->vertices[1].texcoords.y * w_inverse1,
-                        triangle->vertices[2].texcoords.y * w_inverse2,
-                        alpha, beta, gamma);
+                    u = planes[RASTER_ATTRIBUTE_U].at(p.x, p.y);
+                    v = planes[RASTER_ATTRIBUTE_V].at(p.x, p.y);
 
                     u /= w_inverse_interpl;
                     v /= w_inverse_interpl;
@@ -363,23 +356,21 @@ void draw_triangle(
                     color = default_color;
                 }
 
-                Vec3f fragment_normal = calculate_fragment_normal(
-                    triangle,
-                    w_inverse0, w_inverse1, w_inverse2,
-                    w_inverse_interpl,
-                    alpha, beta, gamma
-                );
+                Vec3f fragment_normal = {
+                    planes[RASTER_ATTRIBUTE_NORMAL_X].at(p.x, p.y) / w_inverse_interpl,
+                    planes[RASTER_ATTRIBUTE_NORMAL_Y].at(p.x, p.y) / w_inverse_interpl,
+                    planes[RASTER_ATTRIBUTE_NORMAL_Z].at(p.x, p.y) / w_inverse_interpl,
+                };
 
                 float alignment = -Vec3f::dot(light->direction.normalize(), fragment_normal);
                 alignment = std::max(alignment, 0.f);
-                float intensity = renderer_state->flags[USE_SHADING] ?
+                float intensity = use_shading ?
                     alignment:
                     1.f;
                 // color = apply_intensity(color, {255, 255, 255, 255}, intensity);
                 color = RAYWHITE;
 
 
-                bool use_z_buffer_check = renderer_state == nullptr ? false : renderer_state->flags[USE_Z_BUFFER];
                 auto depth_buffer_value = *buffer_pixel_get(depth_buffer, p.x, p.y);
                 if (w_inverse_interpl < depth_buffer_value && use_z_buffer_check) {
                     continue;
@@ -388,18 +379,14 @@ void draw_triangle(
                 float color_float = w_inverse_interpl * 255.0;
                 uint8_t z_buffer_pixel_val = round(clamp(color_float, 0.0, 255.0));
 
-                auto z_value = apply_barycentric(
-                    triangle->vertices[0].position.z * w_inverse0,
-                    triangle->vertices[1].position.z * w_inverse1,
-                    triangle->vertices[2].position.z * w_inverse2,
-                    alpha, beta, gamma);
+                auto z_value = planes[RASTER_ATTRIBUTE_Z].at(p.x, p.y);
                 z_value /= -w_inverse_interpl;
                 z_value = 1 - z_value;
 
 
 
                 // normals_color
-                if (renderer_state->flags[RenderingFlags::USE_FACE_NORMALS]) {
+                if (use_face_normals) {
                     // generate fragment normal color
                     // color = tiny_color_from_rgb(
                     //     (1 + fragment_normal.x) * 128,
@@ -408,7 +395,7 @@ void draw_triangle(
                     // );
                 }
 
-                if (renderer_state->flags[RenderingFlags::DRAW_DEPTH_BUFFER]) {
+                if (draw_depth_buffer) {
                     // color = tiny_color_from_rgb(
                     //     z_buffer_pixel_val,
                     //     z_buffer_pixel_val,
@@ -420,6 +407,10 @@ void draw_triangle(
                 color_buffer->set_pixel(p.x, p.y, color);
             }
         }
+
+        for (int i = 0; i < 3; i++) {
+            e_row[i] += edges.edges[i].b;
+        }
     }
 }
 
@@ -7,9 +7,12 @@
 
 #include "color_buffer.h"
 #include "depth_buffer.h"
+#include "g_buffer.h"
+#include "visibility_buffer.h"
 #include "tiny_math.h"
 #include "mesh.h"
 #include "camera.h"
+#include "raster.h"
 #include "shader.h"
 
 #include "../examples/renderer.h"
@@ -44,12 +47,26 @@ void draw_triangle(
     RendererState *renderer_state
 );
 
+// Rasterizes a screen-space triangle with depth testing, shading it with
+// `fragment_shader` and its `uniforms`. When `scissor`
+// ({x_start, x_end, y_start, y_end}, inclusive) is passed, only pixels inside
+// it are touched. When `g_buffer` or `visibility_buffer` is passed, visible
+// fragments are written there instead of being shaded. `triangle_id` tells
+// where the triangle came from, see triangle_id_make. `setup_edges` are the
+// triangle's edges when the caller has set them up already, so triangles
+// drawn in several pieces only do that once, see triangle_edges_setup.
 void depth_test(
     CameraType camera_type,
     ColorBuffer *color_buffer,
     DepthBuffer *depth_buffer,
     TinyTriangle *triangle,
-    FragmentShader fragment_shader
+    FragmentShader fragment_shader,
+    void *uniforms,
+    const int *scissor = nullptr,
+    GBuffer *g_buffer = nullptr,
+    uint32_t triangle_id = 0,
+    VisibilityBuffer *visibility_buffer = nullptr,
+    const TriangleEdges *setup_edges = nullptr
 );
 
 void draw_axis(ColorBuffer *color_buffer);
@@ -0,0 +1,223 @@
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "g_buffer.h"
+
+// Resolve jobs cover this many rows each
+#define G_BUFFER_RESOLVE_ROWS 16
+
+static float sign_not_zero(float value) {
+    return value >= 0.f ? 1.f : -1.f;
+}
+
+static int16_t snorm16(float value) {
+    return lrintf(std::clamp(value, -1.f, 1.f) * INT16_MAX);
+}
+
+// Projects the direction onto an octahedron and unfolds it into a square,
+// so two components are enough
+static uint32_t pack_normal(Vec3f normal) {
+    float l1_norm = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+    if (l1_norm == 0.f) {
+        return 0;
+    }
+
+    float x = normal.x / l1_norm;
+    float y = normal.y / l1_norm;
+
+    // Fold the lower half over the diagonals
+    if (normal.z < 0.f) {
+        float folded_x = (1.f - fabsf(y)) * sign_not_zero(x);
+        float folded_y = (1.f - fabsf(x)) * sign_not_zero(y);
+        x = folded_x;
+        y = folded_y;
+    }
+
+    return (uint16_t)snorm16(x) | (uint32_t)(uint16_t)snorm16(y) << 16;
+}
+
+static Vec3f unpack_normal(uint32_t packed) {
+    float x = (int16_t)(packed & 0xFFFF) / (float)INT16_MAX;
+    float y = (int16_t)(packed >> 16) / (float)INT16_MAX;
+    float z = 1.f - fabsf(x) - fabsf(y);
+
+    if (z < 0.f) {
+        float unfolded_x = (1.f - fabsf(y)) * sign_not_zero(x);
+        float unfolded_y = (1.f - fabsf(x)) * sign_not_zero(y);
+        x = unfolded_x;
+        y = unfolded_y;
+    }
+
+    Vec3f normal = { x, y, z };
+    normal.normalize();
+
+    return normal;
+}
+
+GBuffer *g_buffer_create(int width, int height) {
+    GBuffer *g_buffer = (GBuffer *)malloc(sizeof(GBuffer));
+    if (!g_buffer) {
+        return nullptr;
+    }
+
+    g_buffer->width = width;
+    g_buffer->height = height;
+    g_buffer->texels = (GBufferTexel *)malloc(width * height * sizeof(GBufferTexel));
+
+    if (!g_buffer->texels) {
+        free(g_buffer);
+        return nullptr;
+    }
+
+    g_buffer_clear(g_buffer);
+
+    return g_buffer;
+}
+
+void g_buffer_destroy(GBuffer *g_buffer) {
+    free(g_buffer->texels);
+    free(g_buffer);
+}
+
+void g_buffer_clear(GBuffer *g_buffer) {
+    size_t size = g_buffer->width * g_buffer->height;
+
+    for (size_t i = 0; i < size; i++) {
+        g_buffer->texels[i].material_id = G_BUFFER_NO_MATERIAL;
+    }
+}
+
+void g_buffer_write(GBuffer *g_buffer, int x, int y, FragmentData *fragment) {
+    GBufferTexel *texel = &g_buffer->texels[y * g_buffer->width + x];
+
+    texel->normal = pack_normal(fragment->normal);
+    texel->u = lrintf(std::clamp(fragment->u, 0.f, 1.f) * UINT16_MAX);
+    texel->v = lrintf(std::clamp(fragment->v, 0.f, 1.f) * UINT16_MAX);
+    texel->material_id = fragment->material_id;
+}
+
+struct GBufferResolveJob {
+    GBuffer *g_buffer;
+    DepthBuffer *depth_buffer;
+    ColorBuffer *color_buffer;
+    FragmentShader fragment_shader;
+    void *uniforms;
+};
+
+static void g_buffer_resolve_rows(void *data, size_t job_idx) {
+    GBufferResolveJob *job = static_cast<GBufferResolveJob *>(data);
+    GBuffer *g_buffer = job->g_buffer;
+
+    int y_start = job_idx * G_BUFFER_RESOLVE_ROWS;
+    int y_end = std::min(g_buffer->height, y_start + G_BUFFER_RESOLVE_ROWS);
+
+    for (int y = y_start; y < y_end; y++) {
+        for (int x = 0; x < g_buffer->width; x++) {
+            int idx = y * g_buffer->width + x;
+            GBufferTexel *texel = &g_buffer->texels[idx];
+
+            if (texel->material_id == G_BUFFER_NO_MATERIAL) {
+                continue;
+            }
+
+            FragmentData fragment = {
+                .depth = job->depth_buffer->data[idx],
+                .u = texel->u / (float)UINT16_MAX,
+                .v = texel->v / (float)UINT16_MAX,
+                .normal = unpack_normal(texel->normal),
+                .custom = {},
+                .material_id = texel->material_id,
+            };
+
+            job->color_buffer->set_pixel(x, y, job->fragment_shader(&fragment, job->uniforms));
+        }
+    }
+}
+
+void g_buffer_resolve(
+    GBuffer *g_buffer,
+    DepthBuffer *depth_buffer,
+    ColorBuffer *color_buffer,
+    FragmentShader fragment_shader,
+    void *uniforms,
+    JobPool *pool
+) {
+    GBufferResolveJob job = {
+        .g_buffer = g_buffer,
+        .depth_buffer = depth_buffer,
+        .color_buffer = color_buffer,
+        .fragment_shader = fragment_shader,
+        .uniforms = uniforms,
+    };
+
+    size_t job_count = (g_buffer->height + G_BUFFER_RESOLVE_ROWS - 1) / G_BUFFER_RESOLVE_ROWS;
+
+    if (pool != nullptr) {
+        job_pool_run(pool, g_buffer_resolve_rows, &job, job_count);
+    } else {
+        for (size_t i = 0; i < job_count; i++) {
+            g_buffer_resolve_rows(&job, i);
+        }
+    }
+}
+
+TEST_CASE("G-buffer normals survive the octahedral encoding") {
+    // Directions all around the sphere, the axes and the octahedron's
+    // folds included
+    for (int i = 0; i <= 16; i++) {
+        for (int j = 0; j < 32; j++) {
+            float polar = (float)M_PI * i / 16;
+            float azimuth = 2 * (float)M_PI * j / 32;
+            Vec3f normal = {
+                sinf(polar) * cosf(azimuth),
+                sinf(polar) * sinf(azimuth),
+                cosf(polar),
+            };
+
+            Vec3f decoded = unpack_normal(pack_normal(normal));
+            CHECK(decoded.length() == doctest::Approx(1.f));
+            CHECK(Vec3f::dot(decoded, normal) > 0.99999f);
+        }
+    }
+}
+
+TEST_CASE("G-buffer texture coordinates round trip as unorm16") {
+    GBuffer *g_buffer = g_buffer_create(2, 1);
+    REQUIRE(g_buffer != nullptr);
+
+    float coordinates[] = { 0.f, 0.1f, 0.25f, 0.5f, 0.999f, 1.f };
+    for (float coordinate : coordinates) {
+        FragmentData fragment = {
+            .depth = 0,
+            .u = coordinate,
+            .v = 1 - coordinate,
+            .normal = { 0, 0, 1 },
+            .custom = {},
+            .material_id = 3,
+        };
+        g_buffer_write(g_buffer, 1, 0, &fragment);
+
+        GBufferTexel *texel = &g_buffer->texels[1];
+        CHECK(fabsf(texel->u / (float)UINT16_MAX - coordinate) <= 0.5f / UINT16_MAX);
+        CHECK(fabsf(texel->v / (float)UINT16_MAX - (1 - coordinate)) <= 0.5f / UINT16_MAX);
+        CHECK(texel->material_id == 3);
+    }
+
+    // Clamped to [0, 1], see GBuffer
+    FragmentData outside = {
+        .depth = 0,
+        .u = -0.25f,
+        .v = 1.75f,
+        .normal = { 0, 0, 1 },
+        .custom = {},
+        .material_id = 0,
+    };
+    g_buffer_write(g_buffer, 0, 0, &outside);
+    CHECK(g_buffer->texels[0].u == 0);
+    CHECK(g_buffer->texels[0].v == UINT16_MAX);
+
+    g_buffer_destroy(g_buffer);
+}
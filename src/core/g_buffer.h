@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "color_buffer.h"
+#include "depth_buffer.h"
+#include "job_pool.h"
+#include "shader.h"
+#include "tiny_math.h"
+
+// Material id of pixels no triangle was written to
+#define G_BUFFER_NO_MATERIAL UINT32_MAX
+
+// Everything but depth, which stays in the DepthBuffer, packed into 12 bytes
+struct GBufferTexel {
+    // Octahedral encoding of the normal direction, two 16 bit snorms
+    uint32_t normal;
+    // Texture coordinates, 16 bit unorms, clamped to [0, 1], see GBuffer
+    uint16_t u, v;
+    uint32_t material_id;
+};
+
+// Deferred shading: the raster pass only fills this in, and
+// g_buffer_resolve runs the fragment shader once per pixel afterwards.
+// Texture coordinates outside of [0, 1] don't survive it, so it's only
+// for materials whose textures are clamped to the edge. Repeating or
+// mirrored textures have to be drawn forward or through a visibility
+// buffer, which interpolates the coordinates as they are.
+struct GBuffer {
+    int width;
+    int height;
+    GBufferTexel *texels;
+};
+
+GBuffer *g_buffer_create(int width, int height);
+void g_buffer_destroy(GBuffer *g_buffer);
+
+void g_buffer_clear(GBuffer *g_buffer);
+
+void g_buffer_write(GBuffer *g_buffer, int x, int y, FragmentData *fragment);
+
+// Shades every written pixel and stores the result in the color buffer.
+// Fragments get the depth from `depth_buffer`. Pixels nothing was written
+// to keep their color.
+void g_buffer_resolve(
+    GBuffer *g_buffer,
+    DepthBuffer *depth_buffer,
+    ColorBuffer *color_buffer,
+    FragmentShader fragment_shader,
+    void *uniforms,
+    JobPool *pool = nullptr
+);
@@ -1,15 +1,14 @@
 #pragma once
 
-#include "./tiny_math.h"
-#include "./matrix.h"
-#include "./mesh.h"
-
-typedef void (*VertexShader)(const TinyVertex *input_vertex, Vec3f *output_vertex, const Matrix4 *modelViewProj);
-typedef void (*FragmentShader)(const TinyVertex *interpolated_vertex, Vec4f *output_color);
+#include "./shader.h"
+#include "./vertex_stage.h"
 
+// The shaders a draw runs. Without a vertex shader the vertex stage only
+// transforms positions and normals, and the custom varyings are unset.
 struct ShaderProgram {
     VertexShader vertex_shader;
     FragmentShader fragment_shader;
-    // Add other shader stages as needed
-    // Add any uniform data shared between shaders
+    // The uniform block of the draw, handed to both shaders. It has to stay
+    // alive and unchanged until the draw's tiles and resolves are done.
+    void *uniforms;
 };
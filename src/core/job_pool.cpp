@@ -0,0 +1,151 @@
+#include <doctest/doctest.h>
+
+#include <algorithm>
+
+#include "job_pool.h"
+
+static bool job_pool_pop(JobPool *pool, int worker_idx, Job *job) {
+    JobQueue *own = &pool->queues[worker_idx];
+    {
+        std::lock_guard<std::mutex> lock(own->mutex);
+        if (!own->jobs.empty()) {
+            *job = own->jobs.front();
+            own->jobs.pop_front();
+            return true;
+        }
+    }
+
+    // Steal from the back, the owner works from the other end
+    for (int i = 1; i < pool->worker_count; i++) {
+        JobQueue *victim = &pool->queues[(worker_idx + i) % pool->worker_count];
+
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->jobs.empty()) {
+            *job = victim->jobs.back();
+            victim->jobs.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void job_pool_work(JobPool *pool, int worker_idx) {
+    Job job;
+
+    // All jobs of a batch are queued before workers are woken up, so once
+    // every queue is empty there's nothing left to pick up
+    while (job_pool_pop(pool, worker_idx, &job)) {
+        job.function(job.data, job.idx);
+
+        if (pool->jobs_left.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            pool->done.notify_all();
+        }
+    }
+}
+
+static void job_pool_worker_loop(JobPool *pool, int worker_idx) {
+    size_t seen_generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->wake.wait(lock, [&] {
+                return pool->quit || pool->generation != seen_generation;
+            });
+
+            if (pool->quit) {
+                return;
+            }
+            seen_generation = pool->generation;
+        }
+
+        job_pool_work(pool, worker_idx);
+    }
+}
+
+JobPool *job_pool_create(int worker_count) {
+    if (worker_count <= 0) {
+        worker_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    JobPool *pool = new JobPool();
+    pool->worker_count = worker_count;
+    pool->queues = new JobQueue[worker_count];
+    pool->jobs_left = 0;
+    pool->generation = 0;
+    pool->quit = false;
+
+    for (int i = 0; i < worker_count - 1; i++) {
+        pool->threads.emplace_back(job_pool_worker_loop, pool, i);
+    }
+
+    return pool;
+}
+
+void job_pool_destroy(JobPool *pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->quit = true;
+    }
+    pool->wake.notify_all();
+
+    for (auto &thread : pool->threads) {
+        thread.join();
+    }
+
+    delete[] pool->queues;
+    delete pool;
+}
+
+void job_pool_run(JobPool *pool, JobFunction function, void *data, size_t job_count) {
+    if (job_count == 0) {
+        return;
+    }
+
+    pool->jobs_left = job_count;
+
+    // Neighbouring jobs go to the same worker, stealing evens the load out
+    size_t per_worker = (job_count + pool->worker_count - 1) / pool->worker_count;
+    for (size_t i = 0; i < job_count; i++) {
+        JobQueue *queue = &pool->queues[i / per_worker];
+
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->jobs.push_back({ function, data, i });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->generation++;
+    }
+    pool->wake.notify_all();
+
+    job_pool_work(pool, pool->worker_count - 1);
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->done.wait(lock, [&] { return pool->jobs_left == 0; });
+}
+
+static void job_count_run(void *data, size_t job_idx) {
+    std::atomic<int> *runs = static_cast<std::atomic<int> *>(data);
+    runs[job_idx]++;
+}
+
+TEST_CASE("job_pool_run runs every job exactly once") {
+    JobPool *pool = job_pool_create(4);
+    REQUIRE(pool != nullptr);
+
+    // Several rounds, so the pool gets reused, including one without jobs
+    size_t job_counts[] = { 1, 1000, 0, 3, 257 };
+    for (size_t job_count : job_counts) {
+        std::vector<std::atomic<int>> runs(job_count);
+        job_pool_run(pool, job_count_run, runs.data(), job_count);
+
+        for (size_t i = 0; i < job_count; i++) {
+            CHECK(runs[i] == 1);
+        }
+    }
+
+    job_pool_destroy(pool);
+}
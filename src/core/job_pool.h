@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef void (*JobFunction)(void *data, size_t job_idx);
+
+struct Job {
+    JobFunction function;
+    void *data;
+    size_t idx;
+};
+
+// Every worker owns a deque. It takes jobs from the front of its own deque
+// and, once that's empty, steals from the back of the others.
+struct JobQueue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+};
+
+struct JobPool {
+    // The thread calling job_pool_run works too, it uses the last queue
+    int worker_count;
+    JobQueue *queues;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::atomic<size_t> jobs_left;
+    size_t generation;
+    bool quit;
+};
+
+// Passing 0 uses one worker per hardware thread
+JobPool *job_pool_create(int worker_count);
+void job_pool_destroy(JobPool *pool);
+
+// Runs function(data, i) for every i in [0, job_count) and returns once all
+// of them are done
+void job_pool_run(JobPool *pool, JobFunction function, void *data, size_t job_count);
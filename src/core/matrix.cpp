@@ -316,6 +316,12 @@ Matrix4 mat4_get_world(Vec3f scale, Vec3f rotation, Vec3f translation) {
     return out;
 }
 
+float mat4_determinant_3x3(Matrix4 *mat) {
+    return mat->m0 * (mat->m5 * mat->m10 - mat->m9 * mat->m6) -
+           mat->m4 * (mat->m1 * mat->m10 - mat->m9 * mat->m2) +
+           mat->m8 * (mat->m1 * mat->m6 - mat->m5 * mat->m2);
+}
+
 Matrix4 transpose_matrix(Matrix4 *other) {
     return {
         other->m0,  other->m1,  other->m2,  other->m3,
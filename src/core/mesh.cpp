@@ -1,7 +1,19 @@
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cmath>
+
 #include "./mesh.h"
+#include "./mesh_optimize.h"
+#include "./bvh.h"
+#include "./meshlet.h"
 #include "../loader_obj.h"
+#include "../tooling/logger.h"
+
+// Every mesh needs a triangle id
+#define MAX_MESHES_COUNT TRIANGLE_ID_MAX_MESHES
 
-#define MAX_MESHES_COUNT 100
+static_assert(MAX_SHAPES_PER_MESH_COUNT <= TRIANGLE_ID_MAX_SHAPES);
 
 /*
  *                                |
@@ -54,10 +66,107 @@ TinyFace cube_faces[CUBE_FACES_COUNT] = {
 };
 
 
+static void mesh_build_streams(TinyMesh *mesh) {
+    size_t padded_count = (mesh->vertex_count + MESH_STREAM_PADDING - 1) / MESH_STREAM_PADDING * MESH_STREAM_PADDING;
+    float **streams[] = {
+        &mesh->streams.position_x,
+        &mesh->streams.position_y,
+        &mesh->streams.position_z,
+        &mesh->streams.normal_x,
+        &mesh->streams.normal_y,
+        &mesh->streams.normal_z,
+    };
+
+    for (float **stream : streams) {
+        *stream = (float *)calloc(padded_count, sizeof(float));
+    }
+
+    for (size_t i = 0; i < mesh->vertex_count; i++) {
+        TinyVertex *vertex = &mesh->vertices[i];
+
+        mesh->streams.position_x[i] = vertex->position.x;
+        mesh->streams.position_y[i] = vertex->position.y;
+        mesh->streams.position_z[i] = vertex->position.z;
+
+        mesh->streams.normal_x[i] = vertex->normal.x;
+        mesh->streams.normal_y[i] = vertex->normal.y;
+        mesh->streams.normal_z[i] = vertex->normal.z;
+    }
+
+    mesh->streams.padded_count = padded_count;
+}
+
+// Box around the vertices faces [0, face_count) use, and a sphere centered
+// on it
+static void compute_bounds(
+    TinyVertex *vertices,
+    TinyFace *faces,
+    int face_count,
+    BoundingBox *box,
+    BoundingSphere *sphere
+) {
+    if (face_count == 0) {
+        *box = {};
+        *sphere = {};
+        return;
+    }
+
+    Vec3f first = vec3_from_vec4(vertices[faces[0].indices[0]].position);
+    box->min = first;
+    box->max = first;
+
+    for (int i = 0; i < face_count; i++) {
+        for (int j = 0; j < 3; j++) {
+            Vec4f p = vertices[faces[i].indices[j]].position;
+
+            box->min = { std::min(box->min.x, p.x), std::min(box->min.y, p.y), std::min(box->min.z, p.z) };
+            box->max = { std::max(box->max.x, p.x), std::max(box->max.y, p.y), std::max(box->max.z, p.z) };
+        }
+    }
+
+    sphere->center = {
+        (box->min.x + box->max.x) / 2,
+        (box->min.y + box->max.y) / 2,
+        (box->min.z + box->max.z) / 2,
+    };
+
+    float radius_squared = 0;
+    for (int i = 0; i < face_count; i++) {
+        for (int j = 0; j < 3; j++) {
+            Vec4f p = vertices[faces[i].indices[j]].position;
+            float dx = p.x - sphere->center.x;
+            float dy = p.y - sphere->center.y;
+            float dz = p.z - sphere->center.z;
+
+            radius_squared = std::max(radius_squared, dx * dx + dy * dy + dz * dz);
+        }
+    }
+
+    sphere->radius = sqrtf(radius_squared);
+}
+
+static void mesh_compute_bounds(TinyMesh *mesh) {
+    std::vector<TinyFace> faces;
+
+    for (size_t i = 0; i < mesh->shape_count; i++) {
+        PS_MeshShape *shape = &mesh->shapes[i];
+
+        compute_bounds(mesh->vertices, shape->faces, shape->face_count, &shape->bounds, &shape->bounding_sphere);
+        faces.insert(faces.end(), shape->faces, shape->faces + shape->face_count);
+    }
+
+    compute_bounds(mesh->vertices, faces.data(), faces.size(), &mesh->bounds, &mesh->bounding_sphere);
+}
+
 static TinyMesh meshes[MAX_MESHES_COUNT];
 static size_t mesh_count = 0;
 
 TinyMesh* ps_load_mesh(char *mesh_path, std::vector<std::string> textures) {
+    if (mesh_count >= MAX_MESHES_COUNT) {
+        log_message(LogLevel::LOG_LEVEL_ERROR, "Mesh %s not loaded, all %u meshes are taken", mesh_path, MAX_MESHES_COUNT);
+        return nullptr;
+    }
+
     std::vector<TinyVertex> vertices;
     PS_Shape shapes[MAX_SHAPES_PER_MESH_COUNT];
     size_t shape_count = 0;
@@ -65,6 +174,18 @@ TinyMesh* ps_load_mesh(char *mesh_path, std::vector<std::string> textures) {
     // TODO: the result is an array of meshes
     parse_mesh(mesh_path, &vertices, shapes, &shape_count);
 
+    // Triangle ids have no room for more faces
+    for (size_t i = 0; i < shape_count; i++) {
+        if (shapes[i].faces.size() > TRIANGLE_ID_MAX_FACES) {
+            log_message(
+                LogLevel::LOG_LEVEL_ERROR,
+                "Mesh %s not loaded, shape %zu has %zu faces, at most %u fit a triangle id",
+                mesh_path, i, shapes[i].faces.size(), TRIANGLE_ID_MAX_FACES
+            );
+            return nullptr;
+        }
+    }
+
     TinyMesh mesh;
     mesh.vertices = (TinyVertex *)malloc(vertices.size() * sizeof(TinyVertex));
     mesh.shapes = (PS_MeshShape *)malloc(shape_count * sizeof(PS_MeshShape));
@@ -87,13 +208,24 @@ TinyMesh* ps_load_mesh(char *mesh_path, std::vector<std::string> textures) {
         mesh.shapes[i].face_count = face_count;
     }
 
+    mesh.vertex_count = vertices.size();
     mesh.shape_count = shape_count;
+
+    for (size_t i = 0; i < mesh.shape_count; i++) {
+        bvh_build(&mesh, &mesh.shapes[i]);
+    }
+    mesh_optimize(&mesh);
+    mesh_build_meshlets(&mesh);
+    mesh_build_streams(&mesh);
+    mesh_compute_bounds(&mesh);
     mesh.scale = { 1.0f, 1.0f, 1.0f };
     mesh.translation = { 0.f, 0.f, 0.f };
 
     // TODO: cleanup + re-use textures
     for (int i = 0; i < textures.size(); i++) {
         auto image = LoadImage(textures[i].c_str());
+        // Shaders read texels as Color
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
         mesh.textures.push_back(image);
     }
 
@@ -123,3 +255,26 @@ Vec3f get_triangle_normal(Vec4f vertices[3]) {
 
 // TODO: cleanup vertices/faces for each mesh
 // and UnloadImage(mesh.diffuse_texture);
+
+TEST_CASE("triangle ids unpack to what they were made from") {
+    uint32_t meshes[] = { 0, 1, TRIANGLE_ID_MAX_MESHES - 1 };
+    uint32_t shapes[] = { 0, 4, TRIANGLE_ID_MAX_SHAPES - 1 };
+    uint32_t faces[] = { 0, 12345, TRIANGLE_ID_MAX_FACES - 1 };
+
+    for (uint32_t mesh_idx : meshes) {
+        for (uint32_t shape_idx : shapes) {
+            for (uint32_t face_idx : faces) {
+                uint32_t triangle_id = triangle_id_make(mesh_idx, shape_idx, face_idx);
+
+                CHECK(triangle_id_mesh(triangle_id) == mesh_idx);
+                CHECK(triangle_id_shape(triangle_id) == shape_idx);
+                CHECK(triangle_id_face(triangle_id) == face_idx);
+
+                // Faces of a shape share their material
+                CHECK(triangle_id_material(triangle_id) == triangle_id_material(triangle_id_make(mesh_idx, shape_idx, 0)));
+            }
+        }
+    }
+
+    CHECK(triangle_id_material(triangle_id_make(0, 1, 0)) != triangle_id_material(triangle_id_make(1, 0, 0)));
+}
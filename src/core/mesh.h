@@ -1,6 +1,8 @@
 #pragma once
 
 #include <raylib.h>
+#include <assert.h>
+#include <stdint.h>
 #include "tiny_math.h"
 #include <vector>
 
@@ -12,11 +14,16 @@ struct TinyFace {
     int indices[3] = {};
 };
 
+// Free varyings a vertex carries to the fragment shader, see
+// FRAGMENT_VARYING_CUSTOM
+#define VARYING_CUSTOM_SLOTS 2
+
 // Stores values
 struct TinyVertex {
     Vec4f position = {};
     Vec3f normal = {};
     Vec2f texcoords = {};
+    float custom[VARYING_CUSTOM_SLOTS] = {};
 
     bool operator==(TinyVertex other) const {
         return position == other.position &&
@@ -29,21 +36,132 @@ struct TinyTriangle {
     TinyVertex vertices[3];
 };
 
+// Identifies the mesh face a rasterized triangle came from, packed into
+// 32 bits: 6 bits of mesh, 6 of shape and 20 of face index. ps_load_mesh
+// rejects meshes that don't fit
+#define TRIANGLE_ID_MESH_BITS 6
+#define TRIANGLE_ID_SHAPE_BITS 6
+#define TRIANGLE_ID_FACE_BITS 20
+
+#define TRIANGLE_ID_MAX_MESHES (1u << TRIANGLE_ID_MESH_BITS)
+#define TRIANGLE_ID_MAX_SHAPES (1u << TRIANGLE_ID_SHAPE_BITS)
+#define TRIANGLE_ID_MAX_FACES (1u << TRIANGLE_ID_FACE_BITS)
+
+static_assert(TRIANGLE_ID_MESH_BITS + TRIANGLE_ID_SHAPE_BITS + TRIANGLE_ID_FACE_BITS == 32);
+
+inline uint32_t triangle_id_make(uint32_t mesh_idx, uint32_t shape_idx, uint32_t face_idx) {
+    assert(mesh_idx < TRIANGLE_ID_MAX_MESHES);
+    assert(shape_idx < TRIANGLE_ID_MAX_SHAPES);
+    assert(face_idx < TRIANGLE_ID_MAX_FACES);
+    return (mesh_idx << TRIANGLE_ID_SHAPE_BITS | shape_idx) << TRIANGLE_ID_FACE_BITS | face_idx;
+}
+
+inline uint32_t triangle_id_mesh(uint32_t triangle_id) {
+    return triangle_id >> (TRIANGLE_ID_SHAPE_BITS + TRIANGLE_ID_FACE_BITS);
+}
+
+inline uint32_t triangle_id_shape(uint32_t triangle_id) {
+    return (triangle_id >> TRIANGLE_ID_FACE_BITS) & ((1u << TRIANGLE_ID_SHAPE_BITS) - 1);
+}
+
+inline uint32_t triangle_id_face(uint32_t triangle_id) {
+    return triangle_id & ((1u << TRIANGLE_ID_FACE_BITS) - 1);
+}
+
+// Materials are per shape, so this is the mesh and shape part of the id
+inline uint32_t triangle_id_material(uint32_t triangle_id) {
+    return triangle_id >> TRIANGLE_ID_FACE_BITS;
+}
+
 extern Vec3f cube_vertices[CUBE_VERTICES_COUNT];
 extern TinyFace cube_faces[CUBE_FACES_COUNT];
 
+// Vertex streams are padded with zeros to a multiple of this, so batch
+// kernels only ever see full batches
+#define MESH_STREAM_PADDING 8
+
+// Positions and normals of TinyMesh::vertices again, as structure of arrays
+// for the batch vertex transform
+struct TinyVertexStreams {
+    size_t padded_count;
+
+    float *position_x;
+    float *position_y;
+    float *position_z;
+
+    float *normal_x;
+    float *normal_y;
+    float *normal_z;
+};
+
+// Bounds in model space
+struct BoundingBox {
+    Vec3f min;
+    Vec3f max;
+};
+
+struct BoundingSphere {
+    Vec3f center;
+    float radius;
+};
+
+// Faces [begin, end) of a shape
+struct FaceRange {
+    int begin;
+    int end;
+};
+
+// Vertices [begin, end) of a mesh
+struct VertexRange {
+    int begin;
+    int end;
+};
+
+// See bvh.h and meshlet.h
+struct BvhNode;
+struct Meshlet;
+
 struct PS_MeshShape {
     TinyFace *faces;
     int face_count = 0;
     int vertex_count = 0;
+
+    // Of the vertices the faces use
+    BoundingBox bounds;
+    BoundingSphere bounding_sphere;
+
+    // Over the faces, built at load time
+    BvhNode *bvh_nodes;
+    int bvh_node_count = 0;
+
+    // In face order, covering all faces
+    Meshlet *meshlets;
+    int meshlet_count = 0;
+};
+
+// Winding of a mesh's front faces, as seen from the front with y up
+enum FaceWinding {
+    FACE_WINDING_COUNTER_CLOCKWISE,
+    FACE_WINDING_CLOCKWISE,
 };
 
 struct TinyMesh {
     TinyVertex *vertices;
     PS_MeshShape *shapes;
 
+    // Shared by all shapes, faces index into it
+    size_t vertex_count;
     size_t shape_count;
 
+    TinyVertexStreams streams;
+
+    // OBJ files, like OpenGL, default to counter clockwise
+    FaceWinding front_face = FACE_WINDING_COUNTER_CLOCKWISE;
+
+    // Of all shapes
+    BoundingBox bounds;
+    BoundingSphere bounding_sphere;
+
     Vec3f rotation = {};
     Vec3f translation = {};
     Vec3f scale = {1, 1, 1};
@@ -52,6 +170,7 @@ struct TinyMesh {
     std::vector<Image> textures;
 };
 
+// Returns nullptr if the mesh doesn't fit, see TRIANGLE_ID_MAX_MESHES
 TinyMesh *ps_load_mesh(char *mesh_path, std::vector<std::string> texture_paths);
 TinyMesh *ps_get_mesh_data();
 size_t ps_get_mesh_count();
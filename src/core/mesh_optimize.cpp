@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "bvh.h"
+#include "mesh_optimize.h"
+#include "../tooling/logger.h"
+
+// Faces of a range of a shape, ordered, and where each cluster of them
+// starts
+struct FaceOrder {
+    std::vector<int> faces;
+    std::vector<size_t> cluster_starts;
+};
+
+// Picks the vertex to fan around next once the current one has no faces
+// left: the most recent vertex on the dead-end stack that still has some,
+// otherwise the next one in input order
+static int tipsify_skip_dead_end(
+    std::vector<int> *live_counts,
+    std::vector<int> *dead_end_stack,
+    int *cursor
+) {
+    while (!dead_end_stack->empty()) {
+        int vertex = dead_end_stack->back();
+        dead_end_stack->pop_back();
+
+        if ((*live_counts)[vertex] > 0) {
+            return vertex;
+        }
+    }
+
+    while (*cursor < (int)live_counts->size()) {
+        int vertex = (*cursor)++;
+
+        if ((*live_counts)[vertex] > 0) {
+            return vertex;
+        }
+    }
+
+    return -1;
+}
+
+static void tipsify(TinyMesh *mesh, PS_MeshShape *shape, FaceRange range, int cache_size, FaceOrder *out) {
+    int vertex_count = mesh->vertex_count;
+
+    // Vertex -> faces using it, as offsets into one array
+    std::vector<int> live_counts(vertex_count, 0);
+    for (int i = range.begin; i < range.end; i++) {
+        for (int j = 0; j < 3; j++) {
+            live_counts[shape->faces[i].indices[j]]++;
+        }
+    }
+
+    std::vector<int> adjacency_offsets(vertex_count + 1, 0);
+    for (int i = 0; i < vertex_count; i++) {
+        adjacency_offsets[i + 1] = adjacency_offsets[i] + live_counts[i];
+    }
+
+    std::vector<int> adjacency(adjacency_offsets[vertex_count]);
+    std::vector<int> adjacency_fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+    for (int i = range.begin; i < range.end; i++) {
+        for (int j = 0; j < 3; j++) {
+            adjacency[adjacency_fill[shape->faces[i].indices[j]]++] = i;
+        }
+    }
+
+    std::vector<int> cache_times(vertex_count, 0);
+    std::vector<bool> emitted(shape->face_count, false);
+    std::vector<int> dead_end_stack;
+    std::vector<int> candidates;
+
+    int time = cache_size + 1;
+    int cursor = 0;
+    int fanning = tipsify_skip_dead_end(&live_counts, &dead_end_stack, &cursor);
+
+    out->faces.clear();
+    out->cluster_starts.clear();
+    out->cluster_starts.push_back(0);
+
+    while (fanning >= 0) {
+        candidates.clear();
+
+        for (int i = adjacency_offsets[fanning]; i < adjacency_offsets[fanning + 1]; i++) {
+            int face_idx = adjacency[i];
+            if (emitted[face_idx]) {
+                continue;
+            }
+
+            for (int j = 0; j < 3; j++) {
+                int vertex = shape->faces[face_idx].indices[j];
+
+                dead_end_stack.push_back(vertex);
+                candidates.push_back(vertex);
+                live_counts[vertex]--;
+
+                if (time - cache_times[vertex] > cache_size) {
+                    cache_times[vertex] = time++;
+                }
+            }
+
+            emitted[face_idx] = true;
+            out->faces.push_back(face_idx);
+        }
+
+        // Next fanning vertex: the candidate that stays in the cache the
+        // longest while its remaining faces are emitted
+        int next = -1;
+        int best_priority = -1;
+
+        for (int vertex : candidates) {
+            if (live_counts[vertex] <= 0) {
+                continue;
+            }
+
+            int priority = 0;
+            if (time - cache_times[vertex] + 2 * live_counts[vertex] <= cache_size) {
+                priority = time - cache_times[vertex];
+            }
+
+            if (priority > best_priority) {
+                best_priority = priority;
+                next = vertex;
+            }
+        }
+
+        if (next == -1) {
+            // Jumping elsewhere on the mesh starts a new cluster
+            next = tipsify_skip_dead_end(&live_counts, &dead_end_stack, &cursor);
+
+            if (next >= 0 && out->faces.size() > out->cluster_starts.back()) {
+                out->cluster_starts.push_back(out->faces.size());
+            }
+        }
+
+        fanning = next;
+    }
+}
+
+// Sorts clusters by how much they face away from the centroid of the
+// range. Those are the ones most likely to cover the rest of it, so drawing
+// them first lets the depth test reject more.
+static void sort_clusters_for_overdraw(TinyMesh *mesh, PS_MeshShape *shape, FaceOrder *order) {
+    size_t cluster_count = order->cluster_starts.size();
+
+    if (cluster_count < 2) {
+        return;
+    }
+
+    Vec3f range_centroid = { 0, 0, 0 };
+    float range_area = 0;
+
+    std::vector<Vec3f> centroids(cluster_count, { 0, 0, 0 });
+    std::vector<Vec3f> normals(cluster_count, { 0, 0, 0 });
+    std::vector<float> areas(cluster_count, 0);
+
+    for (size_t c = 0; c < cluster_count; c++) {
+        size_t end = c + 1 < cluster_count ? order->cluster_starts[c + 1] : order->faces.size();
+
+        for (size_t i = order->cluster_starts[c]; i < end; i++) {
+            TinyFace *face = &shape->faces[order->faces[i]];
+            Vec3f p[3];
+            for (int j = 0; j < 3; j++) {
+                p[j] = vec3_from_vec4(mesh->vertices[face->indices[j]].position);
+            }
+
+            // Twice the area, it cancels out
+            Vec3f edge_ab = p[1] - p[0];
+            Vec3f edge_ac = p[2] - p[0];
+            Vec3f normal = Vec3f::cross(edge_ab, edge_ac);
+            float area = normal.length();
+
+            normals[c].x += normal.x;
+            normals[c].y += normal.y;
+            normals[c].z += normal.z;
+
+            centroids[c].x += (p[0].x + p[1].x + p[2].x) * area;
+            centroids[c].y += (p[0].y + p[1].y + p[2].y) * area;
+            centroids[c].z += (p[0].z + p[1].z + p[2].z) * area;
+            areas[c] += area;
+        }
+
+        range_centroid.x += centroids[c].x;
+        range_centroid.y += centroids[c].y;
+        range_centroid.z += centroids[c].z;
+        range_area += areas[c];
+    }
+
+    if (range_area == 0.f) {
+        return;
+    }
+
+    range_centroid = range_centroid * (1.f / (3.f * range_area));
+
+    std::vector<float> keys(cluster_count, 0);
+    for (size_t c = 0; c < cluster_count; c++) {
+        float normal_length = normals[c].length();
+        if (areas[c] == 0.f || normal_length == 0.f) {
+            continue;
+        }
+
+        Vec3f centroid = centroids[c] * (1.f / (3.f * areas[c]));
+        keys[c] = Vec3f::dot(centroid - range_centroid, normals[c]) / normal_length;
+    }
+
+    std::vector<size_t> clusters(cluster_count);
+    for (size_t c = 0; c < cluster_count; c++) {
+        clusters[c] = c;
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [&keys](size_t a, size_t b) {
+        return keys[a] > keys[b];
+    });
+
+    std::vector<int> faces;
+    faces.reserve(order->faces.size());
+
+    for (size_t c : clusters) {
+        size_t end = c + 1 < cluster_count ? order->cluster_starts[c + 1] : order->faces.size();
+        faces.insert(faces.end(), order->faces.begin() + order->cluster_starts[c], order->faces.begin() + end);
+    }
+
+    order->faces.swap(faces);
+}
+
+float mesh_shape_acmr(TinyMesh *mesh, size_t shape_idx, int cache_size) {
+    PS_MeshShape *shape = &mesh->shapes[shape_idx];
+
+    if (shape->face_count == 0) {
+        return 0;
+    }
+
+    // Vertex -> the value `loads` had when it was put in the cache
+    std::vector<int> load_times(mesh->vertex_count, -cache_size - 1);
+    int loads = 0;
+
+    for (int i = 0; i < shape->face_count; i++) {
+        for (int j = 0; j < 3; j++) {
+            int vertex = shape->faces[i].indices[j];
+
+            if (loads - load_times[vertex] > cache_size) {
+                load_times[vertex] = loads++;
+            }
+        }
+    }
+
+    return (float)loads / shape->face_count;
+}
+
+void mesh_optimize(TinyMesh *mesh) {
+    FaceOrder order;
+    std::vector<TinyFace> faces;
+
+    for (size_t i = 0; i < mesh->shape_count; i++) {
+        PS_MeshShape *shape = &mesh->shapes[i];
+        float acmr_before = mesh_shape_acmr(mesh, i, MESH_OPTIMIZE_CACHE_SIZE);
+        size_t cluster_count = 0;
+
+        // Faces stay in their leaf, so the BVH ranges hold
+        for (int node_idx = 0; node_idx < shape->bvh_node_count; node_idx++) {
+            BvhNode *node = &shape->bvh_nodes[node_idx];
+            if (node->right_child != 0) {
+                continue;
+            }
+
+            FaceRange range = { node->face_begin, node->face_end };
+            tipsify(mesh, shape, range, MESH_OPTIMIZE_CACHE_SIZE, &order);
+            sort_clusters_for_overdraw(mesh, shape, &order);
+
+            faces.assign(shape->faces + range.begin, shape->faces + range.end);
+            for (int j = range.begin; j < range.end; j++) {
+                shape->faces[j] = faces[order.faces[j - range.begin] - range.begin];
+            }
+
+            cluster_count += order.cluster_starts.size();
+        }
+
+        log_message(
+            LogLevel::LOG_LEVEL_DEBUG,
+            "Shape %zu: %d faces, %zu clusters, ACMR %.3f -> %.3f",
+            i,
+            shape->face_count,
+            cluster_count,
+            acmr_before,
+            mesh_shape_acmr(mesh, i, MESH_OPTIMIZE_CACHE_SIZE)
+        );
+    }
+}
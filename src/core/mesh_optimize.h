@@ -0,0 +1,19 @@
+#pragma once
+
+#include "mesh.h"
+
+// Vertex cache size faces are ordered for
+#define MESH_OPTIMIZE_CACHE_SIZE 16
+
+// Load time reordering, run by ps_load_mesh after bvh_build: faces of every
+// BVH leaf are reordered for vertex cache locality with Tipsify (Sander,
+// Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and
+// Reduced Overdraw"), and the clusters it produces are sorted so outward
+// facing ones come first, which reduces overdraw from most view directions.
+// Faces stay within their leaf. Vertices are renumbered in first use order
+// afterwards, by mesh_build_meshlets.
+void mesh_optimize(TinyMesh *mesh);
+
+// Average cache misses per face of a shape when drawn through a FIFO vertex
+// cache of `cache_size` entries
+float mesh_shape_acmr(TinyMesh *mesh, size_t shape_idx, int cache_size);
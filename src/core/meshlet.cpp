@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "bvh.h"
+#include "meshlet.h"
+
+static float det3(Vec3f a, Vec3f b, Vec3f c) {
+    return
+        a.x * (b.y * c.z - b.z * c.y) +
+        a.y * (b.z * c.x - b.x * c.z) +
+        a.z * (b.x * c.y - b.y * c.x);
+}
+
+static void meshlet_compute_bounds(Meshlet *meshlet, PS_MeshShape *shape, TinyVertex *vertices) {
+    Vec3f first = vec3_from_vec4(vertices[meshlet->vertices.begin].position);
+    BoundingBox box = { first, first };
+
+    for (int i = meshlet->vertices.begin; i < meshlet->vertices.end; i++) {
+        Vec4f p = vertices[i].position;
+
+        box.min = { std::min(box.min.x, p.x), std::min(box.min.y, p.y), std::min(box.min.z, p.z) };
+        box.max = { std::max(box.max.x, p.x), std::max(box.max.y, p.y), std::max(box.max.z, p.z) };
+    }
+
+    Vec3f center = {
+        (box.min.x + box.max.x) / 2,
+        (box.min.y + box.max.y) / 2,
+        (box.min.z + box.max.z) / 2,
+    };
+
+    float radius_squared = 0;
+    for (int i = meshlet->vertices.begin; i < meshlet->vertices.end; i++) {
+        Vec4f p = vertices[i].position;
+        float dx = p.x - center.x;
+        float dy = p.y - center.y;
+        float dz = p.z - center.z;
+
+        radius_squared = std::max(radius_squared, dx * dx + dy * dy + dz * dz);
+    }
+
+    meshlet->bounding_sphere = { center, sqrtf(radius_squared) };
+
+    // Unit face normals, zero area faces have none
+    std::vector<Vec3f> normals;
+    Vec3f normal_sum = { 0, 0, 0 };
+
+    for (int i = meshlet->faces.begin; i < meshlet->faces.end; i++) {
+        int *indices = shape->faces[i].indices;
+        Vec3f a = vec3_from_vec4(vertices[indices[0]].position);
+        Vec3f b = vec3_from_vec4(vertices[indices[1]].position);
+        Vec3f c = vec3_from_vec4(vertices[indices[2]].position);
+
+        Vec3f ab = b - a;
+        Vec3f ac = c - a;
+        Vec3f normal = Vec3f::cross(ab, ac);
+
+        float length = normal.length();
+        if (length > 0.f) {
+            normal = normal * (1.f / length);
+            normals.push_back(normal);
+            normal_sum = normal_sum + normal;
+        }
+    }
+
+    meshlet->cone_axis = { 0, 0, 0 };
+    meshlet->cone_cos = 0;
+    meshlet->cone_sin = 1;
+
+    float sum_length = normal_sum.length();
+    if (normals.empty() || sum_length <= 0.f) {
+        return;
+    }
+
+    Vec3f axis = normal_sum * (1.f / sum_length);
+    float min_cos = 1;
+    for (Vec3f normal : normals) {
+        min_cos = std::min(min_cos, Vec3f::dot(axis, normal));
+    }
+
+    // Room for rounding in the normals, so the test stays conservative
+    min_cos -= 1e-4f;
+
+    meshlet->cone_axis = axis;
+    meshlet->cone_cos = min_cos;
+    meshlet->cone_sin = sqrtf(std::max(0.f, 1.f - min_cos * min_cos));
+}
+
+void mesh_build_meshlets(TinyMesh *mesh) {
+    std::vector<TinyVertex> vertices;
+    vertices.reserve(mesh->vertex_count);
+
+    // Old vertex -> its new index in the latest meshlet that used it
+    std::vector<int> remap(mesh->vertex_count, -1);
+
+    for (size_t i = 0; i < mesh->shape_count; i++) {
+        PS_MeshShape *shape = &mesh->shapes[i];
+        std::vector<Meshlet> meshlets;
+
+        for (int node_idx = 0; node_idx < shape->bvh_node_count; node_idx++) {
+            BvhNode *node = &shape->bvh_nodes[node_idx];
+            if (node->right_child != 0) {
+                continue;
+            }
+
+            // Leaves come in face order
+            int face_idx = node->face_begin;
+            while (face_idx < node->face_end) {
+                Meshlet meshlet = {};
+                meshlet.faces.begin = face_idx;
+                meshlet.vertices.begin = vertices.size();
+
+                for (; face_idx < node->face_end; face_idx++) {
+                    if (face_idx - meshlet.faces.begin == MESHLET_MAX_FACES) {
+                        break;
+                    }
+
+                    int *indices = shape->faces[face_idx].indices;
+
+                    int new_vertices = 0;
+                    for (int k = 0; k < 3; k++) {
+                        bool seen = remap[indices[k]] >= meshlet.vertices.begin;
+                        bool repeated = (k > 0 && indices[k] == indices[0]) || (k > 1 && indices[k] == indices[1]);
+
+                        new_vertices += !seen && !repeated;
+                    }
+
+                    if ((int)vertices.size() - meshlet.vertices.begin + new_vertices > MESHLET_MAX_VERTICES) {
+                        break;
+                    }
+
+                    for (int k = 0; k < 3; k++) {
+                        int *index = &indices[k];
+
+                        if (remap[*index] < meshlet.vertices.begin) {
+                            remap[*index] = vertices.size();
+                            vertices.push_back(mesh->vertices[*index]);
+                        }
+
+                        *index = remap[*index];
+                    }
+                }
+
+                meshlet.faces.end = face_idx;
+                meshlet.vertices.end = vertices.size();
+                meshlets.push_back(meshlet);
+            }
+        }
+
+        shape->meshlet_count = meshlets.size();
+        shape->meshlets = (Meshlet *)malloc(meshlets.size() * sizeof(Meshlet));
+        std::copy(meshlets.begin(), meshlets.end(), shape->meshlets);
+    }
+
+    free(mesh->vertices);
+    mesh->vertex_count = vertices.size();
+    mesh->vertices = (TinyVertex *)malloc(vertices.size() * sizeof(TinyVertex));
+    std::copy(vertices.begin(), vertices.end(), mesh->vertices);
+
+    for (size_t i = 0; i < mesh->shape_count; i++) {
+        PS_MeshShape *shape = &mesh->shapes[i];
+
+        for (int j = 0; j < shape->meshlet_count; j++) {
+            meshlet_compute_bounds(&shape->meshlets[j], shape, mesh->vertices);
+        }
+    }
+}
+
+Vec4f meshlet_eye(Matrix4 *mat_model_clip) {
+    Matrix4 *m = mat_model_clip;
+
+    // Columns of the x, y and w rows
+    Vec3f c0 = { m->m0, m->m1, m->m3 };
+    Vec3f c1 = { m->m4, m->m5, m->m7 };
+    Vec3f c2 = { m->m8, m->m9, m->m11 };
+    Vec3f c3 = { m->m12, m->m13, m->m15 };
+
+    // Cofactors: dot(eye, p) is minus the 4x4 determinant of the three rows
+    // and p
+    return {
+        det3(c1, c2, c3),
+        -det3(c0, c2, c3),
+        det3(c0, c1, c3),
+        -det3(c0, c1, c2),
+    };
+}
+
+bool meshlet_cone_culled(Meshlet *meshlet, Vec4f eye, TriangleCull cull) {
+    if (cull == TRIANGLE_CULL_NONE || meshlet->cone_cos <= 0.f) {
+        return false;
+    }
+
+    // The culled faces are the ones where the winding determinant has the
+    // sign of `side`
+    float side = cull == TRIANGLE_CULL_COUNTER_CLOCKWISE ? 1.f : -1.f;
+
+    BoundingSphere *sphere = &meshlet->bounding_sphere;
+    Vec3f v = {
+        side * (eye.x - sphere->center.x * eye.w),
+        side * (eye.y - sphere->center.y * eye.w),
+        side * (eye.z - sphere->center.z * eye.w),
+    };
+
+    // For a face at the center of the sphere, the determinant is dot(n, v).
+    // Its smallest value over the cone is |v| cos(angle(v, axis) + half
+    // angle), moving the face within the sphere changes it by at most
+    // radius * |eye.w|.
+    float along = Vec3f::dot(v, meshlet->cone_axis);
+    if (along <= 0.f) {
+        return false;
+    }
+
+    float across = sqrtf(std::max(0.f, Vec3f::dot(v, v) - along * along));
+    float smallest = along * meshlet->cone_cos - across * meshlet->cone_sin;
+
+    return smallest > sphere->radius * fabsf(eye.w);
+}
+
+void meshlets_cull(
+    PS_MeshShape *shape,
+    FaceRange *ranges, size_t range_count,
+    Frustum *frustum,
+    Vec4f eye,
+    TriangleCull cull,
+    std::vector<FaceRange> *faces,
+    std::vector<VertexRange> *vertices
+) {
+    Meshlet *meshlets_end = shape->meshlets + shape->meshlet_count;
+
+    for (size_t i = 0; i < range_count; i++) {
+        Meshlet *meshlet = std::lower_bound(
+            shape->meshlets,
+            meshlets_end,
+            ranges[i].begin,
+            [](Meshlet &meshlet, int face_idx) { return meshlet.faces.begin < face_idx; }
+        );
+
+        for (; meshlet < meshlets_end && meshlet->faces.begin < ranges[i].end; meshlet++) {
+            if (!frustum_test_sphere(frustum, &meshlet->bounding_sphere) ||
+                meshlet_cone_culled(meshlet, eye, cull)) {
+                continue;
+            }
+
+            // Meshlets that follow each other are merged
+            if (!faces->empty() && faces->back().end == meshlet->faces.begin) {
+                faces->back().end = meshlet->faces.end;
+            } else {
+                faces->push_back(meshlet->faces);
+            }
+
+            if (!vertices->empty() && vertices->back().end == meshlet->vertices.begin) {
+                vertices->back().end = meshlet->vertices.end;
+            } else {
+                vertices->push_back(meshlet->vertices);
+            }
+        }
+    }
+}
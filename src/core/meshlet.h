@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+
+#include "clipping.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "triangle_classify.h"
+
+// Limits of a meshlet. BVH leaves are split further into meshlets, so they
+// never hold more faces than this, see BVH_LEAF_FACES.
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_FACES 124
+
+// A run of faces of a shape and the vertices only they use. Every meshlet
+// has its own vertices, duplicated where shapes or meshlets meet, so
+// transforming just the meshlets that can be seen covers all their faces.
+struct Meshlet {
+    FaceRange faces;
+    VertexRange vertices;
+
+    BoundingSphere bounding_sphere;
+
+    // Cone around the geometric normals of the faces, as given by their
+    // winding: all of them are within the half angle of the axis. Can't cull
+    // when cone_cos <= 0.
+    Vec3f cone_axis;
+    float cone_cos;
+    float cone_sin;
+};
+
+// Splits the BVH leaves of every shape into meshlets and gives the meshlets
+// their own vertices, renumbered in first use order. Run by ps_load_mesh
+// after bvh_build and mesh_optimize.
+void mesh_build_meshlets(TinyMesh *mesh);
+
+// The camera in model space, in homogeneous coordinates: the point every
+// position maps to x = y = w = 0 from. w is 0 for orthographic projections,
+// which makes it the direction towards the camera. Scaled so that the
+// winding determinant of triangle_classify equals
+// dot(n, eye.xyz - p * eye.w), n being cross(b - a, c - a) and p any
+// point of the face.
+Vec4f meshlet_eye(Matrix4 *mat_model_clip);
+
+// True when every face of the meshlet would be dropped by `cull`
+bool meshlet_cone_culled(Meshlet *meshlet, Vec4f eye, TriangleCull cull);
+
+// Appends the faces and vertices of the meshlets in `ranges`, which have to
+// start and end on meshlet boundaries like BVH ranges do, that are neither
+// outside the frustum nor culled by their cone
+void meshlets_cull(
+    PS_MeshShape *shape,
+    FaceRange *ranges, size_t range_count,
+    Frustum *frustum,
+    Vec4f eye,
+    TriangleCull cull,
+    std::vector<FaceRange> *faces,
+    std::vector<VertexRange> *vertices
+);
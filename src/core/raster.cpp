@@ -0,0 +1,271 @@
+#include <doctest/doctest.h>
+
+#include <cmath>
+
+#include "raster.h"
+#include "raster_kernels.h"
+#include "../tooling/logger.h"
+
+// Edge from `from` to `to` in 28.4 fixed point. Values of the returned
+// function are in 1/256 pixel^2, so `c` needs 64 bits.
+static void edge_function(const int32_t from[2], const int32_t to[2], int32_t *a, int32_t *b, int64_t *c) {
+    // E(p) = (to.x - from.x) * (p.y - from.y) - (p.x - from.x) * (to.y - from.y)
+    *a = from[1] - to[1];
+    *b = to[0] - from[0];
+    *c = -((int64_t)*a * from[0] + (int64_t)*b * from[1]);
+}
+
+bool triangle_edges_setup(Vec2f vertices[3], int target_width, int target_height, TriangleEdges *out) {
+    float center_x = target_width * 0.5f;
+    float center_y = target_height * 0.5f;
+    int32_t snapped[3][2];
+
+    for (int i = 0; i < 3; i++) {
+        // Written so NaNs fail too. The guard band keeps clipped vertices in
+        // range, so getting here means the clipper let something through.
+        if (!(fabsf(vertices[i].x - center_x) <= RASTER_MAX_COORDINATE &&
+              fabsf(vertices[i].y - center_y) <= RASTER_MAX_COORDINATE)) {
+            log_message(
+                LogLevel::LOG_LEVEL_WARN,
+                "Triangle dropped, vertex (%.1f, %.1f) is out of range of a %dx%d target",
+                vertices[i].x,
+                vertices[i].y,
+                target_width,
+                target_height
+            );
+            return false;
+        }
+
+        snapped[i][0] = lrintf(vertices[i].x * RASTER_SUBPIXEL_STEPS);
+        snapped[i][1] = lrintf(vertices[i].y * RASTER_SUBPIXEL_STEPS);
+    }
+
+    int32_t a[3], b[3];
+    int64_t c[3];
+    edge_function(snapped[1], snapped[2], &a[0], &b[0], &c[0]);
+    edge_function(snapped[2], snapped[0], &a[1], &b[1], &c[1]);
+    edge_function(snapped[0], snapped[1], &a[2], &b[2], &c[2]);
+
+    int64_t area = (int64_t)a[0] * snapped[0][0] + (int64_t)b[0] * snapped[0][1] + c[0];
+    if (area == 0) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        // Flip clockwise triangles, so the inside test is always E >= 0
+        if (area < 0) {
+            a[i] = -a[i];
+            b[i] = -b[i];
+            c[i] = -c[i];
+        }
+
+        // With y pointing down, the inside is right of a left edge (a > 0)
+        // and below a horizontal top edge (b > 0). Pixels exactly on any
+        // other edge are left out, so E >= 0 becomes E >= 1 for those.
+        bool top_left = a[i] > 0 || (a[i] == 0 && b[i] > 0);
+        if (!top_left) {
+            c[i] -= 1;
+        }
+
+        // Pixels are sampled on the integer grid, so a * x + b * y is a
+        // multiple of RASTER_SUBPIXEL_STEPS there, and flooring c by the
+        // same amount doesn't change the sign of E. What's left fits in
+        // 32 bits and is stepped in whole pixels.
+        out->edges[i].a = a[i];
+        out->edges[i].b = b[i];
+        out->edges[i].c = c[i] >> RASTER_SUBPIXEL_BITS;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        out->vertices[i].x = (float)snapped[i][0] / RASTER_SUBPIXEL_STEPS;
+        out->vertices[i].y = (float)snapped[i][1] / RASTER_SUBPIXEL_STEPS;
+    }
+    out->area_inverse = (float)(RASTER_SUBPIXEL_STEPS * RASTER_SUBPIXEL_STEPS) / area;
+
+    return true;
+}
+
+void triangle_attributes_setup(
+    TinyTriangle *triangle,
+    TriangleEdges *edges,
+    uint32_t attributes,
+    TriangleAttributes *out
+) {
+    float vertex_values[RASTER_ATTRIBUTE_COUNT][3];
+
+    for (int i = 0; i < 3; i++) {
+        TinyVertex *vertex = &triangle->vertices[i];
+        float w_inverse = 1 / vertex->position.w;
+
+        vertex_values[RASTER_ATTRIBUTE_W_INVERSE][i] = w_inverse;
+        vertex_values[RASTER_ATTRIBUTE_Z][i] = vertex->position.z * w_inverse;
+        vertex_values[RASTER_ATTRIBUTE_U][i] = vertex->texcoords.x * w_inverse;
+        vertex_values[RASTER_ATTRIBUTE_V][i] = vertex->texcoords.y * w_inverse;
+        vertex_values[RASTER_ATTRIBUTE_NORMAL_X][i] = vertex->normal.x * w_inverse;
+        vertex_values[RASTER_ATTRIBUTE_NORMAL_Y][i] = vertex->normal.y * w_inverse;
+        vertex_values[RASTER_ATTRIBUTE_NORMAL_Z][i] = vertex->normal.z * w_inverse;
+        for (int k = 0; k < VARYING_CUSTOM_SLOTS; k++) {
+            vertex_values[RASTER_ATTRIBUTE_CUSTOM + k][i] = vertex->custom[k] * w_inverse;
+        }
+    }
+
+    Vec2f *p = edges->vertices;
+    float d1x = p[1].x - p[0].x;
+    float d1y = p[1].y - p[0].y;
+    float d2x = p[2].x - p[0].x;
+    float d2y = p[2].y - p[0].y;
+
+    // Gradient of the plane through the three vertex values, solved with
+    // Cramer's rule; the determinant is the doubled area
+    for (int k = 0; k < RASTER_ATTRIBUTE_COUNT; k++) {
+        if (!(attributes & (1u << k))) {
+            continue;
+        }
+
+        AttributePlane *plane = &out->planes[k];
+        float value0 = vertex_values[k][0];
+        float delta1 = vertex_values[k][1] - value0;
+        float delta2 = vertex_values[k][2] - value0;
+
+        plane->dx = (delta1 * d2y - delta2 * d1y) * edges->area_inverse;
+        plane->dy = (delta2 * d1x - delta1 * d2x) * edges->area_inverse;
+        plane->c = value0 - plane->dx * p[0].x - plane->dy * p[0].y;
+
+        for (int i = 0; i < RASTER_BLOCK_SIZE; i++) {
+            out->lane_steps[k][i] = plane->dx * i;
+        }
+    }
+}
+
+// Registered shaders and their kernels. Only written at init, before any
+// draw runs.
+#define RASTER_MAX_SHADERS 16
+
+struct RegisteredShader {
+    FragmentShader shader;
+    RasterKernelTable *table;
+};
+
+static RegisteredShader registered_shaders[RASTER_MAX_SHADERS];
+static int registered_shader_count = 0;
+
+void raster_register_kernels(FragmentShader shader, RasterKernelTable *table) {
+    for (int i = 0; i < registered_shader_count; i++) {
+        if (registered_shaders[i].shader == shader) {
+            registered_shaders[i].table = table;
+            return;
+        }
+    }
+
+    // Draws with a shader that didn't fit still render, through the
+    // generic kernels
+    if (registered_shader_count == RASTER_MAX_SHADERS) {
+        log_message(
+            LogLevel::LOG_LEVEL_WARN,
+            "Raster kernels not registered, all %d slots are taken",
+            RASTER_MAX_SHADERS
+        );
+        return;
+    }
+
+    registered_shaders[registered_shader_count++] = { shader, table };
+}
+
+static bool simd_enabled = true;
+
+RasterKernel raster_kernel(CameraType camera_type, RasterTarget target, FragmentShader shader) {
+    static RasterKernelTable generic_table = raster_kernel_table<RasterShaderCall>();
+
+    RasterKernelTable *table = &generic_table;
+
+    // Only shading depends on the shader
+    if (target == RASTER_TARGET_COLOR) {
+        for (int i = 0; i < registered_shader_count; i++) {
+            if (registered_shaders[i].shader == shader) {
+                table = registered_shaders[i].table;
+                break;
+            }
+        }
+    }
+
+    return simd_enabled ?
+        table->simd[camera_type][target] :
+        table->scalar[camera_type][target];
+}
+
+void raster_use_simd(bool enabled) {
+    simd_enabled = enabled;
+}
+
+static int edges_cover(TriangleEdges *edges, int x, int y) {
+    for (int i = 0; i < 3; i++) {
+        if (edges->edges[i].at(x, y) < 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+TEST_CASE("triangle_edges_setup covers pixels on shared edges exactly once") {
+    // A fan around a point off the pixel grid that covers a rectangle, its
+    // inner edges are sloped and cross pixels. The last face winds the
+    // other way.
+    Vec2f center = { 5.3f, 4.7f };
+    Vec2f corners[4] = { { 0, 0 }, { 11, 0 }, { 11, 9 }, { 0, 9 } };
+    TriangleEdges fan[4];
+
+    for (int i = 0; i < 4; i++) {
+        Vec2f vertices[3] = { center, corners[i], corners[(i + 1) % 4] };
+        if (i == 3) {
+            std::swap(vertices[1], vertices[2]);
+        }
+        REQUIRE(triangle_edges_setup(vertices, 16, 16, &fan[i]));
+    }
+
+    // Split along a diagonal, whose pixels lie exactly on it
+    Vec2f upper[3] = { { 0, 0 }, { 8, 0 }, { 8, 8 } };
+    Vec2f lower[3] = { { 0, 0 }, { 8, 8 }, { 0, 8 } };
+    TriangleEdges square[2];
+    REQUIRE(triangle_edges_setup(upper, 16, 16, &square[0]));
+    REQUIRE(triangle_edges_setup(lower, 16, 16, &square[1]));
+
+    for (int y = -2; y < 14; y++) {
+        for (int x = -2; x < 14; x++) {
+            int fan_hits = 0;
+            for (int i = 0; i < 4; i++) {
+                fan_hits += edges_cover(&fan[i], x, y);
+            }
+            int square_hits = edges_cover(&square[0], x, y) + edges_cover(&square[1], x, y);
+
+            // Top and left edges are in, right and bottom ones out
+            CHECK(fan_hits == (x >= 0 && x < 11 && y >= 0 && y < 9));
+            CHECK(square_hits == (x >= 0 && x < 8 && y >= 0 && y < 8));
+        }
+    }
+}
+
+TEST_CASE("triangle_edges_setup drops degenerate triangles") {
+    TriangleEdges edges;
+
+    Vec2f collinear[3] = { { 1, 1 }, { 4, 4 }, { 9, 9 } };
+    CHECK_FALSE(triangle_edges_setup(collinear, 16, 16, &edges));
+
+    // Apart, but snapped to the same subpixel
+    Vec2f tiny[3] = { { 2, 2 }, { 2.01f, 2 }, { 2, 2.01f } };
+    CHECK_FALSE(triangle_edges_setup(tiny, 16, 16, &edges));
+}
+
+TEST_CASE("triangle_edges_setup drops vertices out of range") {
+    TriangleEdges edges;
+    float limit = 32 + RASTER_MAX_COORDINATE;
+
+    Vec2f at_limit[3] = { { 0, 0 }, { limit, 0 }, { 0, limit } };
+    CHECK(triangle_edges_setup(at_limit, 64, 64, &edges));
+
+    Vec2f past_limit[3] = { { 0, 0 }, { limit + 1, 0 }, { 0, 8 } };
+    CHECK_FALSE(triangle_edges_setup(past_limit, 64, 64, &edges));
+
+    Vec2f not_a_number[3] = { { 0, 0 }, { NAN, 0 }, { 0, 8 } };
+    CHECK_FALSE(triangle_edges_setup(not_a_number, 64, 64, &edges));
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "camera.h"
+#include "color_buffer.h"
+#include "depth_buffer.h"
+#include "g_buffer.h"
+#include "mesh.h"
+#include "shader.h"
+#include "tiny_math.h"
+#include "visibility_buffer.h"
+
+// The block kernels have SSE2 and AVX2 versions on x86-64, see
+// raster_kernels.h
+#if defined(__x86_64__)
+#define RASTER_SIMD_X86
+#endif
+
+// Side of the screen-aligned pixel blocks that are tested against the edges
+// as a whole before any per-pixel work
+#define RASTER_BLOCK_SIZE 8
+
+// Every block lines up with one cell of the Hi-Z level
+static_assert(RASTER_BLOCK_SIZE == DEPTH_HIZ_CELL_SIZE);
+
+// Vertices are snapped to a 1/RASTER_SUBPIXEL_STEPS pixel grid (28.4 fixed
+// point) before any coverage work, so coverage only depends on integer math
+#define RASTER_SUBPIXEL_BITS 4
+#define RASTER_SUBPIXEL_STEPS (1 << RASTER_SUBPIXEL_BITS)
+
+// Vertices have to lie within RASTER_MAX_COORDINATE pixels of the target's
+// center on x and y. Pixels are sampled on the target, so every edge value
+// stays within 32 bits for targets up to 2 * RASTER_MAX_COORDINATE across.
+// The clipper's guard band keeps vertices inside of that, see
+// clip_guard_band.
+#define RASTER_MAX_COORDINATE 2048
+
+// Edge function from Pineda's paper: E(x, y) = a * x + b * y + c, evaluated
+// at pixel coordinates. It's zero on the edge and positive on the inner side
+// of the triangle, so stepping one pixel along a row adds `a` and moving to
+// the next row adds `b`. The fill rule is folded into `c`: a pixel is
+// covered when E >= 0 for all three edges.
+struct EdgeFunction {
+    int32_t a, b, c;
+
+    int32_t at(int32_t x, int32_t y) const { return a * x + b * y + c; }
+};
+
+struct TriangleEdges {
+    // edges[i] is the edge opposite to vertex i
+    EdgeFunction edges[3];
+
+    // Snapped vertices in pixels, attributes are interpolated from these
+    Vec2f vertices[3];
+    // Inverse of the signed doubled area of the snapped triangle
+    float area_inverse;
+};
+
+// Snaps the vertices and sets the edge equations up once per triangle.
+// Pixels on an edge shared by two triangles belong to exactly one of them
+// (top-left rule). Returns false for degenerate triangles, which cover no
+// pixels, and for vertices out of range of a target_width x target_height
+// target, including NaNs.
+bool triangle_edges_setup(Vec2f vertices[3], int target_width, int target_height, TriangleEdges *out);
+
+// Attributes interpolated across a triangle. All but W_INVERSE are divided
+// by w first, which makes them linear in screen space.
+enum RasterAttribute {
+    RASTER_ATTRIBUTE_W_INVERSE,
+    RASTER_ATTRIBUTE_Z,
+    RASTER_ATTRIBUTE_U,
+    RASTER_ATTRIBUTE_V,
+    RASTER_ATTRIBUTE_NORMAL_X,
+    RASTER_ATTRIBUTE_NORMAL_Y,
+    RASTER_ATTRIBUTE_NORMAL_Z,
+    // One per custom varying slot
+    RASTER_ATTRIBUTE_CUSTOM,
+
+    RASTER_ATTRIBUTE_COUNT = RASTER_ATTRIBUTE_CUSTOM + VARYING_CUSTOM_SLOTS,
+};
+
+#define RASTER_ATTRIBUTES_ALL ((1u << RASTER_ATTRIBUTE_COUNT) - 1)
+
+// A screen-space linear attribute: value(x, y) = dx * x + dy * y + c
+struct AttributePlane {
+    float dx, dy, c;
+
+    float at(float x, float y) const { return dx * x + dy * y + c; }
+};
+
+struct TriangleAttributes {
+    AttributePlane planes[RASTER_ATTRIBUTE_COUNT];
+
+    // lane_steps[k][i] = planes[k].dx * i, the offset of the i-th pixel of a
+    // block row from the first one. With these, kernels get any pixel of a
+    // row with a single add, and all of them get the same values.
+    float lane_steps[RASTER_ATTRIBUTE_COUNT][RASTER_BLOCK_SIZE];
+};
+
+// Computes the gradients of the attributes in `attributes`, bits of
+// RasterAttribute, once per triangle from the edges set up by
+// triangle_edges_setup. The other planes are left unset.
+void triangle_attributes_setup(
+    TinyTriangle *triangle,
+    TriangleEdges *edges,
+    uint32_t attributes,
+    TriangleAttributes *out
+);
+
+// Everything a covered pixel of a triangle needs to be shaded
+struct FragmentContext {
+    CameraType camera_type;
+    ColorBuffer *color_buffer;
+    DepthBuffer *depth_buffer;
+    TinyTriangle *triangle;
+    FragmentShader fragment_shader;
+    void *uniforms;
+    // With a G-buffer, fragments are stored there and shaded later
+    GBuffer *g_buffer;
+    // With a visibility buffer, only the triangle id is stored and no
+    // attributes are interpolated at all
+    VisibilityBuffer *visibility_buffer;
+    uint32_t triangle_id;
+
+    TriangleAttributes attributes;
+};
+
+// What fragments that pass the depth test are written to, besides their
+// depth
+enum RasterTarget {
+    // Nothing, a pure depth fill
+    RASTER_TARGET_DEPTH,
+    // Shaded into the color buffer
+    RASTER_TARGET_COLOR,
+    // Stored in the G-buffer and shaded later
+    RASTER_TARGET_G_BUFFER,
+    // Only the triangle id, no attributes are interpolated at all
+    RASTER_TARGET_VISIBILITY,
+
+    RASTER_TARGET_COUNT,
+};
+
+// The attributes a pass reads, as bits of RasterAttribute: the depth, and
+// for shaded or deferred passes the varyings and 1 / w to divide them by
+constexpr uint32_t raster_attributes(CameraType camera_type, RasterTarget target, uint32_t varyings) {
+    uint32_t attributes = camera_type == CameraType::ORTHOGRAPHIC ?
+        1u << RASTER_ATTRIBUTE_Z :
+        1u << RASTER_ATTRIBUTE_W_INVERSE;
+
+    if (target == RASTER_TARGET_DEPTH || target == RASTER_TARGET_VISIBILITY) {
+        return attributes;
+    }
+
+    // The G-buffer keeps all it has room for, whatever the shader reads
+    if (target == RASTER_TARGET_G_BUFFER) {
+        varyings = FRAGMENT_VARYING_UV | FRAGMENT_VARYING_NORMAL;
+    }
+
+    if (varyings & FRAGMENT_VARYING_UV) {
+        attributes |= 1u << RASTER_ATTRIBUTE_U | 1u << RASTER_ATTRIBUTE_V;
+    }
+    if (varyings & FRAGMENT_VARYING_NORMAL) {
+        attributes |=
+            1u << RASTER_ATTRIBUTE_NORMAL_X |
+            1u << RASTER_ATTRIBUTE_NORMAL_Y |
+            1u << RASTER_ATTRIBUTE_NORMAL_Z;
+    }
+    for (int i = 0; i < VARYING_CUSTOM_SLOTS; i++) {
+        if (varyings & (FRAGMENT_VARYING_CUSTOM << i)) {
+            attributes |= 1u << (RASTER_ATTRIBUTE_CUSTOM + i);
+        }
+    }
+
+    if (attributes & ~(1u << RASTER_ATTRIBUTE_Z | 1u << RASTER_ATTRIBUTE_W_INVERSE)) {
+        attributes |= 1u << RASTER_ATTRIBUTE_W_INVERSE;
+    }
+
+    return attributes;
+}
+
+// Rasterizes the pixels of [x_start, x_end] x [y_start, y_end], which lie
+// inside a single block. When the block is known to be fully covered,
+// `test_coverage` is false and the edge tests are skipped. Returns whether
+// any depth was written.
+typedef bool (*RasterBlockKernel)(
+    FragmentContext *ctx,
+    TriangleEdges *edges,
+    int x_start, int x_end,
+    int y_start, int y_end,
+    bool test_coverage
+);
+
+// A block kernel and the attributes it reads, which are the only ones that
+// need to be set up
+struct RasterKernel {
+    RasterBlockKernel block;
+    uint32_t attributes;
+};
+
+// Kernels of one fragment shader for every projection and target, indexed
+// by CameraType and RasterTarget. The SIMD ones are the fastest the CPU
+// supports. See raster_kernels.h.
+struct RasterKernelTable {
+    RasterKernel scalar[2][RASTER_TARGET_COUNT];
+    RasterKernel simd[2][RASTER_TARGET_COUNT];
+};
+
+// Makes draws with `shader` use `table`, see raster_register_shader. Slots
+// are limited, once they're taken draws with new shaders keep the generic
+// kernels and a warning is logged.
+void raster_register_kernels(FragmentShader shader, RasterKernelTable *table);
+
+// Picks the kernel for a draw. Shaders that weren't registered get kernels
+// calling them through the pointer. Targets other than RASTER_TARGET_COLOR
+// don't call the shader.
+RasterKernel raster_kernel(CameraType camera_type, RasterTarget target, FragmentShader shader);
+void raster_use_simd(bool enabled);
@@ -0,0 +1,617 @@
+#pragma once
+
+// Block kernels as templates over the projection, the target and the
+// fragment shader, so each instantiation has no per-fragment branches on
+// them and the shader call can be inlined. Included where the shaders are
+// known, see raster_register_shader.
+
+#include <algorithm>
+
+#include "cpu_features.h"
+#include "raster.h"
+
+#ifdef RASTER_SIMD_X86
+#include <immintrin.h>
+
+#define RASTER_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Calls the shader the draw was set up with through its pointer, for
+// shaders nobody registered. Nothing is known about what they read, so they
+// get every varying.
+struct RasterShaderCall {
+    static constexpr uint32_t varyings = FRAGMENT_VARYING_ALL;
+    static constexpr FragmentPacketShader packet_shader = nullptr;
+
+    static Color shade(FragmentContext *ctx, FragmentData *fragment) {
+        return ctx->fragment_shader(fragment, ctx->uniforms);
+    }
+};
+
+// Calls `shader` directly, where its body is visible it gets inlined.
+// `shader_varyings` are the FragmentVarying bits it reads, the fields of
+// FragmentData it doesn't are left zero. With a `shader_packet`, the SIMD
+// kernels shade a block row at a time with it instead.
+template <FragmentShader shader, uint32_t shader_varyings, FragmentPacketShader shader_packet>
+struct RasterStaticShader {
+    static constexpr uint32_t varyings = shader_varyings;
+    static constexpr FragmentPacketShader packet_shader = shader_packet;
+
+    static Color shade(FragmentContext *ctx, FragmentData *fragment) {
+        return shader(fragment, ctx->uniforms);
+    }
+};
+
+// Writes a fragment that passed the depth test to the G-buffer or shades it
+// into the color buffer
+template <RasterTarget target, typename Shader>
+inline static void raster_write_fragment(FragmentContext *ctx, int x, int y, FragmentData *fragment) {
+    if constexpr (target == RASTER_TARGET_G_BUFFER) {
+        g_buffer_write(ctx->g_buffer, x, y, fragment);
+    } else {
+        ctx->color_buffer->set_pixel(x, y, Shader::shade(ctx, fragment));
+    }
+}
+
+// Value of attribute k at the pixel `lane` pixels right of the row start
+inline static float lane_value(TriangleAttributes *attributes, float *row_values, int k, int lane) {
+    return row_values[k] + attributes->lane_steps[k][lane];
+}
+
+// Whether `attributes`, bits of RasterAttribute, has attribute k
+constexpr bool raster_reads(uint32_t attributes, int k) {
+    return attributes & (1u << k);
+}
+
+// Whether any attribute besides the depth is read, they all need w
+constexpr bool raster_reads_varyings(uint32_t attributes) {
+    return attributes & ~(1u << RASTER_ATTRIBUTE_W_INVERSE | 1u << RASTER_ATTRIBUTE_Z);
+}
+
+// SECTION: Scalar
+// Returns whether the fragment passed the depth test
+template <CameraType camera_type, RasterTarget target, typename Shader>
+inline static bool shade_fragment(FragmentContext *ctx, int x, int y, int lane, float *row_values) {
+    constexpr uint32_t reads = raster_attributes(camera_type, target, Shader::varyings);
+    TriangleAttributes *attributes = &ctx->attributes;
+
+    float depth_value = camera_type == CameraType::ORTHOGRAPHIC ?
+        lane_value(attributes, row_values, RASTER_ATTRIBUTE_Z, lane) :
+        lane_value(attributes, row_values, RASTER_ATTRIBUTE_W_INVERSE, lane);
+
+    auto depth_buffer_value = *buffer_pixel_get(ctx->depth_buffer, x, y);
+
+    if (depth_value < depth_buffer_value) {
+        return false;
+    }
+
+    if constexpr (target == RASTER_TARGET_VISIBILITY) {
+        ctx->visibility_buffer->ids[y * ctx->visibility_buffer->width + x] = ctx->triangle_id;
+    } else if constexpr (target != RASTER_TARGET_DEPTH) {
+        FragmentData shader_data = {
+            .depth = depth_value,
+            .u = 0,
+            .v = 0,
+            .normal = { 0, 0, 0 },
+            .custom = {},
+            .material_id = triangle_id_material(ctx->triangle_id),
+        };
+
+        if constexpr (raster_reads_varyings(reads)) {
+            // Undo the division by w, u and v are from 0 to 1 again
+            float w = 1 / lane_value(attributes, row_values, RASTER_ATTRIBUTE_W_INVERSE, lane);
+
+            if constexpr (raster_reads(reads, RASTER_ATTRIBUTE_U)) {
+                shader_data.u = lane_value(attributes, row_values, RASTER_ATTRIBUTE_U, lane) * w;
+                shader_data.v = lane_value(attributes, row_values, RASTER_ATTRIBUTE_V, lane) * w;
+            }
+            if constexpr (raster_reads(reads, RASTER_ATTRIBUTE_NORMAL_X)) {
+                shader_data.normal = {
+                    lane_value(attributes, row_values, RASTER_ATTRIBUTE_NORMAL_X, lane) * w,
+                    lane_value(attributes, row_values, RASTER_ATTRIBUTE_NORMAL_Y, lane) * w,
+                    lane_value(attributes, row_values, RASTER_ATTRIBUTE_NORMAL_Z, lane) * w,
+                };
+            }
+            for (int k = 0; k < VARYING_CUSTOM_SLOTS; k++) {
+                if (raster_reads(reads, RASTER_ATTRIBUTE_CUSTOM + k)) {
+                    shader_data.custom[k] = lane_value(attributes, row_values, RASTER_ATTRIBUTE_CUSTOM + k, lane) * w;
+                }
+            }
+        }
+
+        raster_write_fragment<target, Shader>(ctx, x, y, &shader_data);
+    }
+
+    depth_buffer_set(ctx->depth_buffer, x, y, depth_value);
+
+    return true;
+}
+
+// Walks the pixels of [x_start, x_end] x [y_start, y_end] stepping the edge
+// functions. Blocks that are known to be fully covered skip the test.
+template <CameraType camera_type, RasterTarget target, typename Shader, bool test_coverage>
+static bool raster_block_walk(
+    FragmentContext *ctx,
+    TriangleEdges *edges,
+    int x_start, int x_end,
+    int y_start, int y_end
+) {
+    constexpr uint32_t reads = raster_attributes(camera_type, target, Shader::varyings);
+    AttributePlane *planes = ctx->attributes.planes;
+
+    int32_t e_row[3];
+    for (int i = 0; i < 3; i++) {
+        e_row[i] = edges->edges[i].at(x_start, y_start);
+    }
+
+    bool written = false;
+
+    // Attribute values at the first pixel of the row, only the ones read
+    // are set up
+    float row_values[RASTER_ATTRIBUTE_COUNT];
+    for (int k = 0; k < RASTER_ATTRIBUTE_COUNT; k++) {
+        if (raster_reads(reads, k)) {
+            row_values[k] = planes[k].at(x_start, y_start);
+        }
+    }
+
+    for (int y = y_start; y <= y_end; y++) {
+        int32_t e0 = e_row[0];
+        int32_t e1 = e_row[1];
+        int32_t e2 = e_row[2];
+
+        for (int x = x_start; x <= x_end; x++,
+                e0 += edges->edges[0].a, e1 += edges->edges[1].a, e2 += edges->edges[2].a) {
+            // Any negative edge value sets the sign bit
+            if (test_coverage && (e0 | e1 | e2) < 0) {
+                continue;
+            }
+
+            written |= shade_fragment<camera_type, target, Shader>(ctx, x, y, x - x_start, row_values);
+        }
+
+        for (int i = 0; i < 3; i++) {
+            e_row[i] += edges->edges[i].b;
+        }
+        for (int k = 0; k < RASTER_ATTRIBUTE_COUNT; k++) {
+            if (raster_reads(reads, k)) {
+                row_values[k] += planes[k].dy;
+            }
+        }
+    }
+
+    return written;
+}
+
+template <CameraType camera_type, RasterTarget target, typename Shader>
+static bool raster_block_scalar(
+    FragmentContext *ctx,
+    TriangleEdges *edges,
+    int x_start, int x_end,
+    int y_start, int y_end,
+    bool test_coverage
+) {
+    if (test_coverage) {
+        return raster_block_walk<camera_type, target, Shader, true>(ctx, edges, x_start, x_end, y_start, y_end);
+    } else {
+        return raster_block_walk<camera_type, target, Shader, false>(ctx, edges, x_start, x_end, y_start, y_end);
+    }
+}
+// SECTION_END
+
+#ifdef RASTER_SIMD_X86
+
+static_assert(FRAGMENT_PACKET_SIZE == RASTER_BLOCK_SIZE);
+
+// Shades every lane set in `mask`, with the packet shader in one go when
+// there is one, otherwise a fragment at a time
+template <RasterTarget target, typename Shader, uint32_t reads>
+inline static void shade_lanes(FragmentContext *ctx, int x, int y, int mask, FragmentPacket *lanes) {
+    if constexpr (target == RASTER_TARGET_COLOR && Shader::packet_shader != nullptr) {
+        Color colors[FRAGMENT_PACKET_SIZE];
+        lanes->material_id = triangle_id_material(ctx->triangle_id);
+        Shader::packet_shader(lanes, mask, ctx->uniforms, colors);
+
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            ctx->color_buffer->set_pixel(x + lane, y, colors[lane]);
+        }
+
+        return;
+    }
+
+    while (mask) {
+        int lane = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        FragmentData shader_data = {
+            .depth = lanes->depth[lane],
+            .u = 0,
+            .v = 0,
+            .normal = { 0, 0, 0 },
+            .custom = {},
+            .material_id = triangle_id_material(ctx->triangle_id),
+        };
+
+        if constexpr (raster_reads(reads, RASTER_ATTRIBUTE_U)) {
+            shader_data.u = lanes->u[lane];
+            shader_data.v = lanes->v[lane];
+        }
+        if constexpr (raster_reads(reads, RASTER_ATTRIBUTE_NORMAL_X)) {
+            shader_data.normal = { lanes->normal_x[lane], lanes->normal_y[lane], lanes->normal_z[lane] };
+        }
+        for (int k = 0; k < VARYING_CUSTOM_SLOTS; k++) {
+            if (raster_reads(reads, RASTER_ATTRIBUTE_CUSTOM + k)) {
+                shader_data.custom[k] = lanes->custom[k][lane];
+            }
+        }
+
+        raster_write_fragment<target, Shader>(ctx, x + lane, y, &shader_data);
+    }
+}
+
+// SECTION: SSE2
+// A whole row of a block at once, 4 pixels at a time
+template <CameraType camera_type, RasterTarget target, typename Shader>
+static bool raster_block_sse(
+    FragmentContext *ctx,
+    TriangleEdges *edges,
+    int x_start, int x_end,
+    int y_start, int y_end,
+    bool test_coverage
+) {
+    constexpr uint32_t reads = raster_attributes(camera_type, target, Shader::varyings);
+    AttributePlane *planes = ctx->attributes.planes;
+
+    __m128 one = _mm_set1_ps(1.f);
+
+    // Edge offsets of the two halves of a block row. SSE2 has no 32-bit
+    // multiply, but these are cheap enough to set up as scalars.
+    __m128i e_lane_step[3][2];
+    int32_t e_row[3];
+    for (int i = 0; i < 3; i++) {
+        int32_t a = edges->edges[i].a;
+        e_lane_step[i][0] = _mm_setr_epi32(0, a, a * 2, a * 3);
+        e_lane_step[i][1] = _mm_setr_epi32(a * 4, a * 5, a * 6, a * 7);
+        e_row[i] = edges->edges[i].at(x_start, y_start);
+    }
+
+    __m128 lane_steps[RASTER_ATTRIBUTE_COUNT][2];
+    float row_values[RASTER_ATTRIBUTE_COUNT];
+    for (int k = 0; k < RASTER_ATTRIBUTE_COUNT; k++) {
+        if (!raster_reads(reads, k)) {
+            continue;
+        }
+
+        for (int half = 0; half < 2; half++) {
+            lane_steps[k][half] = _mm_loadu_ps(ctx->attributes.lane_steps[k] + half * 4);
+        }
+        row_values[k] = planes[k].at(x_start, y_start);
+    }
+
+    int depth_width = ctx->depth_buffer->width;
+    bool written = false;
+
+    for (int y = y_start; y <= y_end; y++) {
+        __m128i e_start[3];
+        for (int i = 0; i < 3; i++) {
+            e_start[i] = _mm_set1_epi32(e_row[i]);
+            e_row[i] += edges->edges[i].b;
+        }
+
+        __m128 row_start[RASTER_ATTRIBUTE_COUNT];
+        for (int k = 0; k < RASTER_ATTRIBUTE_COUNT; k++) {
+            if (!raster_reads(reads, k)) {
+                continue;
+            }
+
+            row_start[k] = _mm_set1_ps(row_values[k]);
+            row_values[k] += planes[k].dy;
+        }
+
+        // Both halves go into one packet, which is shaded once the row is
+        // done. Lanes of a half that is skipped are never set, so they are
+        // zeroed for the packet shader rather than left undefined.
+        FragmentPacket lanes;
+        if constexpr (Shader::packet_shader != nullptr) {
+            lanes = {};
+        }
+        int row_mask = 0;
+
+        for (int half = 0, x = x_start; x <= x_end; half++, x += 4) {
+            int lane_count = std::min(4, x_end - x + 1);
+            int lane_mask = (1 << lane_count) - 1;
+
+            if (test_coverage) {
+                __m128i e0 = _mm_add_epi32(e_start[0], e_lane_step[0][half]);
+                __m128i e1 = _mm_add_epi32(e_start[1], e_lane_step[1][half]);
+                __m128i e2 = _mm_add_epi32(e_start[2], e_lane_step[2][half]);
+
+                // Lanes with any negative edge value have the sign bit set
+                __m128i outside = _mm_or_si128(_mm_or_si128(e0, e1), e2);
+                lane_mask &= ~_mm_movemask_ps(_mm_castsi128_ps(outside));
+            }
+
+            if (lane_mask == 0) {
+                continue;
+            }
+
+#define LANES(k) _mm_add_ps(row_start[k], lane_steps[k][half])
+
+            __m128 depth = camera_type == CameraType::ORTHOGRAPHIC ?
+                LANES(RASTER_ATTRIBUTE_Z) :
+                LANES(RASTER_ATTRIBUTE_W_INVERSE);
+
+            float *depth_row = ctx->depth_buffer->data + y * depth_width + x;
+
+            // Lanes past the end of the block may belong to another tile,
+            // so they are never loaded or stored as a whole
+            __m128 stored;
+            if (lane_count == 4) {
+                stored = _mm_loadu_ps(depth_row);
+            } else {
+                float stored_lanes[4] = {};
+                for (int i = 0; i < lane_count; i++) {
+                    stored_lanes[i] = depth_row[i];
+                }
+                stored = _mm_loadu_ps(stored_lanes);
+            }
+
+            lane_mask &= _mm_movemask_ps(_mm_cmpge_ps(depth, stored));
+            if (lane_mask == 0) {
+                continue;
+            }
+
+            int lane_offset = half * 4;
+            _mm_storeu_ps(lanes.depth + lane_offset, depth);
+
+            written = true;
+
+            if (lane_mask == 0xF) {
+                _mm_storeu_ps(depth_row, depth);
+            } else {
+                for (int i = 0; i < lane_count; i++) {
+                    if (lane_mask & (1 << i)) {
+                        depth_row[i] = lanes.depth[lane_offset + i];
+                    }
+                }
+            }
+
+            if constexpr (target == RASTER_TARGET_VISIBILITY) {
+                uint32_t *id_row = ctx->visibility_buffer->ids + y * depth_width + x;
+                for (int i = 0; i < lane_count; i++) {
+                    if (lane_mask & (1 << i)) {
+                        id_row[i] = ctx->triangle_id;
+                    }
+                }
+            } else if constexpr (target != RASTER_TARGET_DEPTH) {
+                if constexpr (raster_reads_varyings(reads)) {
+                    __m128 w = _mm_div_ps(one, LANES(RASTER_ATTRIBUTE_W_INVERSE));
+
+#define STORE_LANES(dst, k) _mm_storeu_ps(dst + lane_offset, _mm_mul_ps(LANES(k), w))
+                    if constexpr (raster_reads(reads, RASTER_ATTRIBUTE_U)) {
+                        STORE_LANES(lanes.u, RASTER_ATTRIBUTE_U);
+                        STORE_LANES(lanes.v, RASTER_ATTRIBUTE_V);
+                    }
+                    if constexpr (raster_reads(reads, RASTER_ATTRIBUTE_NORMAL_X)) {
+                        STORE_LANES(lanes.normal_x, RASTER_ATTRIBUTE_NORMAL_X);
+                        STORE_LANES(lanes.normal_y, RASTER_ATTRIBUTE_NORMAL_Y);
+                        STORE_LANES(lanes.normal_z, RASTER_ATTRIBUTE_NORMAL_Z);
+                    }
+                    for (int k = 0; k < VARYING_CUSTOM_SLOTS; k++) {
+                        if (raster_reads(reads, RASTER_ATTRIBUTE_CUSTOM + k)) {
+                            STORE_LANES(lanes.custom[k], RASTER_ATTRIBUTE_CUSTOM + k);
+                        }
+                    }
+#undef STORE_LANES
+                }
+
+                row_mask |= lane_mask << lane_offset;
+            }
+
+#undef LANES
+        }
+
+        if constexpr (target == RASTER_TARGET_COLOR || target == RASTER_TARGET_G_BUFFER) {
+            if (row_mask != 0) {
+                shade_lanes<target, Shader, reads>(ctx, x_start, y, row_mask, &lanes);
+            }
+        }
+    }
+
+    return written;
+}
+// SECTION_END
+
+// SECTION: AVX2
+// A whole row of a block at once, it is at most 8 pixels wide. Only call
+// when the CPU supports AVX2.
+template <CameraType camera_type, RasterTarget target, typename Shader>
+RASTER_AVX2 static bool raster_block_avx2(
+    FragmentContext *ctx,
+    TriangleEdges *edges,
+    int x_start, int x_end,
+    int y_start, int y_end,
+    bool test_coverage
+) {
+    constexpr uint32_t reads = raster_attributes(camera_type, target, Shader::varyings);
+    AttributePlane *planes = ctx->attributes.planes;
+
+    int lane_count = x_end - x_start + 1;
+    __m256i lanes_in_block = _mm256_cmpgt_epi32(
+        _mm256_set1_epi32(lane_count),
+        _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    int block_mask = (1 << lane_count) - 1;
+
+    __m256 one = _mm256_set1_ps(1.f);
+    __m256i lane_offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256i e_lane_step[3];
+    int32_t e_row[3];
+    for (int i = 0; i < 3; i++) {
+        e_lane_step[i] = _mm256_mullo_epi32(_mm256_set1_epi32(edges->edges[i].a), lane_offsets);
+        e_row[i] = edges->edges[i].at(x_start, y_start);
+    }
+
+    __m256 lane_steps[RASTER_ATTRIBUTE_COUNT];
+    float row_values[RASTER_ATTRIBUTE_COUNT];
+    for (int k = 0; k < RASTER_ATTRIBUTE_COUNT; k++) {
+        if (!raster_reads(reads, k)) {
+            continue;
+        }
+
+        lane_steps[k] = _mm256_loadu_ps(ctx->attributes.lane_steps[k]);
+        row_values[k] = planes[k].at(x_start, y_start);
+    }
+
+    int depth_width = ctx->depth_buffer->width;
+    bool written = false;
+
+    for (int y = y_start; y <= y_end; y++) {
+        __m256i e_start[3];
+        for (int i = 0; i < 3; i++) {
+            e_start[i] = _mm256_set1_epi32(e_row[i]);
+            e_row[i] += edges->edges[i].b;
+        }
+
+        float row_start[RASTER_ATTRIBUTE_COUNT];
+        for (int k = 0; k < RASTER_ATTRIBUTE_COUNT; k++) {
+            if (!raster_reads(reads, k)) {
+                continue;
+            }
+
+            row_start[k] = row_values[k];
+            row_values[k] += planes[k].dy;
+        }
+
+        int lane_mask = block_mask;
+        if (test_coverage) {
+            __m256i e0 = _mm256_add_epi32(e_start[0], e_lane_step[0]);
+            __m256i e1 = _mm256_add_epi32(e_start[1], e_lane_step[1]);
+            __m256i e2 = _mm256_add_epi32(e_start[2], e_lane_step[2]);
+
+            // Lanes with any negative edge value have the sign bit set
+            __m256i outside = _mm256_or_si256(_mm256_or_si256(e0, e1), e2);
+            lane_mask &= ~_mm256_movemask_ps(_mm256_castsi256_ps(outside));
+        }
+
+        if (lane_mask == 0) {
+            continue;
+        }
+
+#define LANES(k) _mm256_add_ps(_mm256_set1_ps(row_start[k]), lane_steps[k])
+
+        __m256 depth = camera_type == CameraType::ORTHOGRAPHIC ?
+            LANES(RASTER_ATTRIBUTE_Z) :
+            LANES(RASTER_ATTRIBUTE_W_INVERSE);
+
+        float *depth_row = ctx->depth_buffer->data + y * depth_width + x_start;
+        __m256 stored = _mm256_maskload_ps(depth_row, lanes_in_block);
+
+        __m256 passed = _mm256_cmp_ps(depth, stored, _CMP_GE_OQ);
+        lane_mask &= _mm256_movemask_ps(passed);
+        if (lane_mask == 0) {
+            continue;
+        }
+
+        // Expand the lane bits back into a vector mask for the store
+        __m256i write_mask = _mm256_cmpgt_epi32(
+            _mm256_and_si256(
+                _mm256_set1_epi32(lane_mask),
+                _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)),
+            _mm256_setzero_si256());
+        _mm256_maskstore_ps(depth_row, write_mask, depth);
+        written = true;
+
+        if constexpr (target == RASTER_TARGET_VISIBILITY) {
+            int *id_row = (int *)ctx->visibility_buffer->ids + y * depth_width + x_start;
+            _mm256_maskstore_epi32(id_row, write_mask, _mm256_set1_epi32(ctx->triangle_id));
+        } else if constexpr (target != RASTER_TARGET_DEPTH) {
+            FragmentPacket lanes;
+            _mm256_storeu_ps(lanes.depth, depth);
+
+            if constexpr (raster_reads_varyings(reads)) {
+                __m256 w = _mm256_div_ps(one, LANES(RASTER_ATTRIBUTE_W_INVERSE));
+
+#define STORE_LANES(dst, k) _mm256_storeu_ps(dst, _mm256_mul_ps(LANES(k), w))
+                if constexpr (raster_reads(reads, RASTER_ATTRIBUTE_U)) {
+                    STORE_LANES(lanes.u, RASTER_ATTRIBUTE_U);
+                    STORE_LANES(lanes.v, RASTER_ATTRIBUTE_V);
+                }
+                if constexpr (raster_reads(reads, RASTER_ATTRIBUTE_NORMAL_X)) {
+                    STORE_LANES(lanes.normal_x, RASTER_ATTRIBUTE_NORMAL_X);
+                    STORE_LANES(lanes.normal_y, RASTER_ATTRIBUTE_NORMAL_Y);
+                    STORE_LANES(lanes.normal_z, RASTER_ATTRIBUTE_NORMAL_Z);
+                }
+                for (int k = 0; k < VARYING_CUSTOM_SLOTS; k++) {
+                    if (raster_reads(reads, RASTER_ATTRIBUTE_CUSTOM + k)) {
+                        STORE_LANES(lanes.custom[k], RASTER_ATTRIBUTE_CUSTOM + k);
+                    }
+                }
+#undef STORE_LANES
+            }
+
+            shade_lanes<target, Shader, reads>(ctx, x_start, y, lane_mask, &lanes);
+        }
+
+#undef LANES
+    }
+
+    return written;
+}
+// SECTION_END
+
+#endif
+
+// Fills the permutation table with every projection and target for one
+// shader
+template <CameraType camera_type, RasterTarget target, typename Shader>
+static void raster_kernel_table_set(RasterKernelTable *table, bool avx2) {
+    constexpr uint32_t reads = raster_attributes(camera_type, target, Shader::varyings);
+
+    table->scalar[camera_type][target] = { raster_block_scalar<camera_type, target, Shader>, reads };
+
+#ifdef RASTER_SIMD_X86
+    if (avx2) {
+        table->simd[camera_type][target] = { raster_block_avx2<camera_type, target, Shader>, reads };
+    } else {
+        // SSE2 is part of x86-64
+        table->simd[camera_type][target] = { raster_block_sse<camera_type, target, Shader>, reads };
+    }
+#else
+    table->simd[camera_type][target] = { raster_block_scalar<camera_type, target, Shader>, reads };
+#endif
+}
+
+template <CameraType camera_type, typename Shader>
+static void raster_kernel_table_set_targets(RasterKernelTable *table, bool avx2) {
+    raster_kernel_table_set<camera_type, RASTER_TARGET_DEPTH, Shader>(table, avx2);
+    raster_kernel_table_set<camera_type, RASTER_TARGET_COLOR, Shader>(table, avx2);
+    raster_kernel_table_set<camera_type, RASTER_TARGET_G_BUFFER, Shader>(table, avx2);
+    raster_kernel_table_set<camera_type, RASTER_TARGET_VISIBILITY, Shader>(table, avx2);
+}
+
+template <typename Shader>
+static RasterKernelTable raster_kernel_table() {
+    bool avx2 = cpu_supports_avx2();
+
+    RasterKernelTable table = {};
+    raster_kernel_table_set_targets<CameraType::PERSPECTIVE, Shader>(&table, avx2);
+    raster_kernel_table_set_targets<CameraType::ORTHOGRAPHIC, Shader>(&table, avx2);
+
+    return table;
+}
+
+// Instantiates the kernels for `shader`, which reads the `varyings`
+// FragmentVarying bits. Draws with it use them from then on instead of
+// calling it through the pointer, and only interpolate those varyings.
+// `packet_shader` has to give the same colors as `shader`, the SIMD kernels
+// use it when given. Call once, at init.
+template <FragmentShader shader, uint32_t varyings, FragmentPacketShader packet_shader = nullptr>
+static void raster_register_shader() {
+    static RasterKernelTable table = raster_kernel_table<RasterStaticShader<shader, varyings, packet_shader>>();
+
+    raster_register_kernels(shader, &table);
+}
@@ -1,12 +1,59 @@
 #pragma once
 
 #include "raylib.h"
+#include "mesh.h"
 #include "tiny_math.h"
 
+// What a fragment shader reads from FragmentData, as bits. Raster kernels
+// only interpolate the varyings their shader declares, the rest of
+// FragmentData is left zero. Depth and the material id are always there.
+enum FragmentVarying {
+    FRAGMENT_VARYING_DEPTH = 1 << 0,
+    FRAGMENT_VARYING_UV = 1 << 1,
+    FRAGMENT_VARYING_NORMAL = 1 << 2,
+    // TinyVertex::custom[i] is FRAGMENT_VARYING_CUSTOM << i
+    FRAGMENT_VARYING_CUSTOM = 1 << 3,
+
+    FRAGMENT_VARYING_ALL = (FRAGMENT_VARYING_CUSTOM << VARYING_CUSTOM_SLOTS) - 1,
+};
+
 struct FragmentData {
     float depth;
     float u, v;
     Vec3f normal;
+    // Only interpolated by forward passes, the G-buffer and the visibility
+    // buffer don't keep them
+    float custom[VARYING_CUSTOM_SLOTS];
+    uint32_t material_id;
 };
 
+// `data` is the FragmentData, `uniforms` the uniform block the draw was
+// bound to. Every fragment of the draw gets the same block, on whichever
+// thread shades it, so shaders only ever read it.
 typedef Color (*FragmentShader)(void* data, void* uniforms);
+
+// Fragments a packet shader runs over at once, a row of a raster block
+#define FRAGMENT_PACKET_SIZE 8
+
+// FRAGMENT_PACKET_SIZE fragments of one triangle, lane i being the pixel i
+// right of the first, as a structure of arrays. Only the varyings the
+// shader declares are filled in.
+struct FragmentPacket {
+    float depth[FRAGMENT_PACKET_SIZE];
+    float u[FRAGMENT_PACKET_SIZE];
+    float v[FRAGMENT_PACKET_SIZE];
+    float normal_x[FRAGMENT_PACKET_SIZE];
+    float normal_y[FRAGMENT_PACKET_SIZE];
+    float normal_z[FRAGMENT_PACKET_SIZE];
+    float custom[VARYING_CUSTOM_SLOTS][FRAGMENT_PACKET_SIZE];
+    uint32_t material_id;
+};
+
+// Shades every lane of `packet` into `colors`, SPMD style: the same code
+// runs for all lanes, so loops over the packet vectorize. Only the lanes
+// set in `mask` (bit i for lane i) are written to the color buffer. The
+// others hold arbitrary values, even NaNs, so nothing computed from them
+// may index memory without being clamped first. The mask is advisory:
+// shading every lane is fine, it's there to skip work that doesn't
+// vectorize, like texture fetches.
+typedef void (*FragmentPacketShader)(FragmentPacket *packet, uint32_t mask, void *uniforms, Color *colors);
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cmath>
+
+#include "display.h"
+#include "tile_renderer.h"
+
+TileBins *tile_bins_create(int width, int height) {
+    TileBins *tile_bins = new TileBins();
+
+    tile_bins->width = width;
+    tile_bins->height = height;
+    tile_bins->tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tile_bins->tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    tile_bins->bins.resize(tile_bins->tiles_x * tile_bins->tiles_y);
+
+    return tile_bins;
+}
+
+void tile_bins_destroy(TileBins *tile_bins) {
+    delete tile_bins;
+}
+
+void tile_bins_add(TileBins *tile_bins, TinyTriangle *triangle, uint32_t triangle_id) {
+    Vec4f *a = &triangle->vertices[0].position;
+    Vec4f *b = &triangle->vertices[1].position;
+    Vec4f *c = &triangle->vertices[2].position;
+
+    // Same bounds as the rasterizer uses, in tiles
+    int x_start = floor(std::min(a->x, std::min(b->x, c->x)));
+    int x_end = ceil(std::max(a->x, std::max(b->x, c->x)));
+    int y_start = floor(std::min(a->y, std::min(b->y, c->y)));
+    int y_end = ceil(std::max(a->y, std::max(b->y, c->y)));
+
+    x_start = std::max(0, x_start);
+    x_end = std::min(tile_bins->width - 1, x_end);
+    y_start = std::max(0, y_start);
+    y_end = std::min(tile_bins->height - 1, y_end);
+
+    if (x_start > x_end || y_start > y_end) {
+        return;
+    }
+
+    Vec2f v_screen[3] = { { a->x, a->y }, { b->x, b->y }, { c->x, c->y } };
+    TriangleEdges edges;
+    if (!triangle_edges_setup(v_screen, tile_bins->width, tile_bins->height, &edges)) {
+        return;
+    }
+
+    uint32_t triangle_idx = tile_bins->triangles.size();
+    tile_bins->triangles.push_back(*triangle);
+    tile_bins->triangle_ids.push_back(triangle_id);
+    tile_bins->edges.push_back(edges);
+
+    for (int tile_y = y_start / TILE_SIZE; tile_y <= y_end / TILE_SIZE; tile_y++) {
+        for (int tile_x = x_start / TILE_SIZE; tile_x <= x_end / TILE_SIZE; tile_x++) {
+            tile_bins->bins[tile_y * tile_bins->tiles_x + tile_x].push_back(triangle_idx);
+        }
+    }
+}
+
+struct TileJob {
+    TileBins *tile_bins;
+    CameraType camera_type;
+    ColorBuffer *color_buffer;
+    DepthBuffer *depth_buffer;
+    FragmentShader fragment_shader;
+    void *uniforms;
+    GBuffer *g_buffer;
+    VisibilityBuffer *visibility_buffer;
+};
+
+static void tile_rasterize(void *data, size_t tile_idx) {
+    TileJob *job = static_cast<TileJob *>(data);
+    TileBins *tile_bins = job->tile_bins;
+
+    int tile_x = tile_idx % tile_bins->tiles_x;
+    int tile_y = tile_idx / tile_bins->tiles_x;
+    auto bin = &tile_bins->bins[tile_idx];
+
+    int scissor[4] = {
+        tile_x * TILE_SIZE,
+        std::min(tile_bins->width, (tile_x + 1) * TILE_SIZE) - 1,
+        tile_y * TILE_SIZE,
+        std::min(tile_bins->height, (tile_y + 1) * TILE_SIZE) - 1,
+    };
+
+    for (size_t i = 0; i < bin->size(); i++) {
+        uint32_t triangle_idx = (*bin)[i];
+
+        depth_test(
+            job->camera_type,
+            job->color_buffer,
+            job->depth_buffer,
+            &tile_bins->triangles[triangle_idx],
+            job->fragment_shader,
+            job->uniforms,
+            scissor,
+            job->g_buffer,
+            tile_bins->triangle_ids[triangle_idx],
+            job->visibility_buffer,
+            &tile_bins->edges[triangle_idx]
+        );
+    }
+
+    bin->clear();
+}
+
+void tile_bins_flush(
+    TileBins *tile_bins,
+    CameraType camera_type,
+    ColorBuffer *color_buffer,
+    DepthBuffer *depth_buffer,
+    FragmentShader fragment_shader,
+    void *uniforms,
+    JobPool *pool,
+    GBuffer *g_buffer,
+    VisibilityBuffer *visibility_buffer
+) {
+    TileJob job = {
+        .tile_bins = tile_bins,
+        .camera_type = camera_type,
+        .color_buffer = color_buffer,
+        .depth_buffer = depth_buffer,
+        .fragment_shader = fragment_shader,
+        .uniforms = uniforms,
+        .g_buffer = g_buffer,
+        .visibility_buffer = visibility_buffer,
+    };
+
+    size_t tile_count = tile_bins->tiles_x * tile_bins->tiles_y;
+
+    if (pool != nullptr) {
+        job_pool_run(pool, tile_rasterize, &job, tile_count);
+    } else {
+        for (size_t i = 0; i < tile_count; i++) {
+            tile_rasterize(&job, i);
+        }
+    }
+
+    tile_bins->triangles.clear();
+    tile_bins->triangle_ids.clear();
+    tile_bins->edges.clear();
+}
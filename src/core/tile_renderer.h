@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "camera.h"
+#include "color_buffer.h"
+#include "depth_buffer.h"
+#include "g_buffer.h"
+#include "job_pool.h"
+#include "visibility_buffer.h"
+#include "mesh.h"
+#include "raster.h"
+#include "shader.h"
+
+// The screen is split into TILE_SIZE x TILE_SIZE tiles. Triangles are first
+// sorted into the tiles they overlap, and then every tile is rasterized on
+// its own, so its color and depth stay in cache for all of its triangles.
+#define TILE_SIZE 16
+
+struct TileBins {
+    int width;
+    int height;
+    int tiles_x;
+    int tiles_y;
+
+    // Screen-space triangles of the current pass
+    std::vector<TinyTriangle> triangles;
+    // Source face of every triangle, see triangle_id_make
+    std::vector<uint32_t> triangle_ids;
+    // Edges of every triangle, set up once when it's binned rather than
+    // once per tile it overlaps
+    std::vector<TriangleEdges> edges;
+    // One list of indices into `triangles` per tile, in submission order
+    std::vector<std::vector<uint32_t>> bins;
+};
+
+TileBins *tile_bins_create(int width, int height);
+void tile_bins_destroy(TileBins *tile_bins);
+
+// Bins a screen-space triangle. Triangles triangle_edges_setup rejects are
+// dropped here.
+void tile_bins_add(TileBins *tile_bins, TinyTriangle *triangle, uint32_t triangle_id = 0);
+
+// Rasterizes every binned triangle tile by tile and empties the bins.
+// With a job pool every tile is a job: a tile is only ever touched by the
+// worker that owns it, and keeps its triangle order, so the output is the
+// same as rasterizing on one thread. With a G-buffer or a visibility buffer,
+// fragments are written there instead of being shaded, see depth_test.
+void tile_bins_flush(
+    TileBins *tile_bins,
+    CameraType camera_type,
+    ColorBuffer *color_buffer,
+    DepthBuffer *depth_buffer,
+    FragmentShader fragment_shader,
+    void *uniforms,
+    JobPool *pool = nullptr,
+    GBuffer *g_buffer = nullptr,
+    VisibilityBuffer *visibility_buffer = nullptr
+);
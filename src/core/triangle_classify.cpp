@@ -0,0 +1,225 @@
+#include <doctest/doctest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "cpu_features.h"
+#include "triangle_classify.h"
+
+void classified_faces_reserve(ClassifiedFaces *out, size_t face_count) {
+    if (face_count <= out->capacity) {
+        return;
+    }
+
+    out->inside = (uint32_t *)realloc(out->inside, face_count * sizeof(uint32_t));
+    out->clipped = (uint32_t *)realloc(out->clipped, face_count * sizeof(uint32_t));
+    out->capacity = face_count;
+}
+
+void classified_faces_free(ClassifiedFaces *out) {
+    free(out->inside);
+    free(out->clipped);
+
+    *out = {};
+}
+
+void triangle_classify_scalar(
+    PS_MeshShape *shape,
+    int begin, int end,
+    VertexStageOutput *vertices,
+    TriangleCull cull,
+    ClassifiedFaces *out
+) {
+    for (int i = begin; i < end; i++) {
+        int *indices = shape->faces[i].indices;
+
+        uint8_t a = vertices->outcodes[indices[0]];
+        uint8_t b = vertices->outcodes[indices[1]];
+        uint8_t c = vertices->outcodes[indices[2]];
+
+        // All vertices outside the same plane
+        if (a & b & c & CLIP_OUTCODE_VIEW_VOLUME) {
+            continue;
+        }
+
+        float x0 = vertices->clip_x[indices[0]];
+        float y0 = vertices->clip_y[indices[0]];
+        float w0 = vertices->clip_w[indices[0]];
+        float x1 = vertices->clip_x[indices[1]];
+        float y1 = vertices->clip_y[indices[1]];
+        float w1 = vertices->clip_w[indices[1]];
+        float x2 = vertices->clip_x[indices[2]];
+        float y2 = vertices->clip_y[indices[2]];
+        float w2 = vertices->clip_w[indices[2]];
+
+        float det =
+            x0 * (y1 * w2 - y2 * w1) +
+            x1 * (y2 * w0 - y0 * w2) +
+            x2 * (y0 * w1 - y1 * w0);
+
+        // Also drops NaNs
+        if (!(det > 0.f || det < 0.f) ||
+            (cull == TRIANGLE_CULL_CLOCKWISE && det < 0.f) ||
+            (cull == TRIANGLE_CULL_COUNTER_CLOCKWISE && det > 0.f)) {
+            continue;
+        }
+
+        // See project_mesh, side planes only matter outside the guard band
+        if ((a | b | c) & (CLIP_OUTCODE_NEAR | CLIP_OUTCODE_FAR | CLIP_OUTCODE_GUARD_BAND)) {
+            out->clipped[out->clipped_count++] = i;
+        } else {
+            out->inside[out->inside_count++] = i;
+        }
+    }
+}
+
+static bool simd_enabled = true;
+
+// Kernel for the bulk of the faces and how many it takes at a time
+struct ClassifyKernel {
+    TriangleClassifyKernel kernel;
+    int width;
+};
+
+static ClassifyKernel triangle_classify_select_kernel() {
+#ifdef TRIANGLE_CLASSIFY_SIMD_X86
+    if (cpu_supports_avx2()) {
+        return { triangle_classify_avx2, 8 };
+    }
+
+    // SSE2 is part of x86-64
+    return { triangle_classify_sse, 4 };
+#else
+    return { triangle_classify_scalar, 1 };
+#endif
+}
+
+void triangle_classify_use_simd(bool enabled) {
+    simd_enabled = enabled;
+}
+
+void triangle_classify_shape(
+    PS_MeshShape *shape,
+    FaceRange *ranges, size_t range_count,
+    VertexStageOutput *vertices,
+    TriangleCull cull,
+    ClassifiedFaces *out
+) {
+    static ClassifyKernel simd_kernel = triangle_classify_select_kernel();
+
+    classified_faces_reserve(out, shape->face_count);
+    out->inside_count = 0;
+    out->clipped_count = 0;
+
+    for (size_t i = 0; i < range_count; i++) {
+        FaceRange range = ranges[i];
+
+        int simd_end = range.begin;
+        if (simd_enabled) {
+            simd_end += (range.end - range.begin) / simd_kernel.width * simd_kernel.width;
+            simd_kernel.kernel(shape, range.begin, simd_end, vertices, cull, out);
+        }
+
+        // What's left over
+        triangle_classify_scalar(shape, simd_end, range.end, vertices, cull, out);
+    }
+}
+
+#ifdef TRIANGLE_CLASSIFY_SIMD_X86
+// Deterministic values in [0, 1)
+static float test_random(uint32_t *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return (*state >> 8) / 16777216.f;
+}
+
+static bool test_faces_equal(ClassifiedFaces *a, ClassifiedFaces *b) {
+    return
+        a->inside_count == b->inside_count &&
+        a->clipped_count == b->clipped_count &&
+        memcmp(a->inside, b->inside, a->inside_count * sizeof(uint32_t)) == 0 &&
+        memcmp(a->clipped, b->clipped, a->clipped_count * sizeof(uint32_t)) == 0;
+}
+
+TEST_CASE("triangle classify kernels match the scalar one") {
+    const int vertex_count = 64;
+    const int face_count = 256;
+    uint32_t seed = 7;
+
+    // Vertices around the camera, so faces fall on both sides of every
+    // plane and of the guard band
+    std::vector<float> values[6];
+    for (int k = 0; k < 6; k++) {
+        values[k].resize(vertex_count);
+        for (int i = 0; i < vertex_count; i++) {
+            values[k][i] = test_random(&seed) * 8.f - 4.f;
+        }
+    }
+
+    TinyVertexStreams streams = {
+        .padded_count = vertex_count,
+        .position_x = values[0].data(),
+        .position_y = values[1].data(),
+        .position_z = values[2].data(),
+        .normal_x = values[3].data(),
+        .normal_y = values[4].data(),
+        .normal_z = values[5].data(),
+    };
+
+    Matrix4 mat_model_clip = mat4_multiply(
+        mat4_get_world({ 1, 1, 1 }, { 0.3f, 0.7f, 0.1f }, { 0, 0, -4 }),
+        mat4_get_perspective_projection(0.75f, 1.2f, -0.1f, -20.f)
+    );
+    Matrix4 mat_normal = mat4_get_identity();
+    GuardBand guard_band = { 1.5f, 1.25f };
+
+    VertexStageOutput vertices = {};
+    vertex_stage_reserve(&vertices, vertex_count);
+    vertex_batch_scalar(&streams, 0, vertex_count, &mat_model_clip, &mat_normal, &guard_band, &vertices);
+
+    // Every 16th face repeats a vertex and has no area
+    std::vector<TinyFace> faces(face_count);
+    for (int i = 0; i < face_count; i++) {
+        for (int j = 0; j < 3; j++) {
+            faces[i].indices[j] = test_random(&seed) * vertex_count;
+        }
+        if (i % 16 == 0) {
+            faces[i].indices[2] = faces[i].indices[0];
+        }
+    }
+
+    PS_MeshShape shape = {};
+    shape.faces = faces.data();
+    shape.face_count = face_count;
+
+    std::vector<TriangleClassifyKernel> kernels = { triangle_classify_sse };
+    if (cpu_supports_avx2()) {
+        kernels.push_back(triangle_classify_avx2);
+    }
+
+    TriangleCull culls[] = { TRIANGLE_CULL_NONE, TRIANGLE_CULL_CLOCKWISE, TRIANGLE_CULL_COUNTER_CLOCKWISE };
+    for (TriangleCull cull : culls) {
+        ClassifiedFaces expected = {};
+        classified_faces_reserve(&expected, face_count);
+        triangle_classify_scalar(&shape, 0, face_count, &vertices, cull, &expected);
+
+        CHECK(expected.inside_count > 0);
+        CHECK(expected.clipped_count > 0);
+        CHECK(expected.inside_count + expected.clipped_count < (size_t)face_count);
+
+        for (TriangleClassifyKernel kernel : kernels) {
+            ClassifiedFaces out = {};
+            classified_faces_reserve(&out, face_count);
+            kernel(&shape, 0, face_count, &vertices, cull, &out);
+
+            CHECK(test_faces_equal(&out, &expected));
+
+            classified_faces_free(&out);
+        }
+
+        classified_faces_free(&expected);
+    }
+
+    vertex_stage_free(&vertices);
+}
+#endif
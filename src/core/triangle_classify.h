@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "mesh.h"
+#include "vertex_stage.h"
+
+// Faces the classifier drops by their winding, seen in NDC with y up
+// before clipping. Faces with zero area are always dropped.
+enum TriangleCull {
+    TRIANGLE_CULL_NONE,
+    TRIANGLE_CULL_CLOCKWISE,
+    TRIANGLE_CULL_COUNTER_CLOCKWISE,
+};
+
+// Face indices of a shape that survived classification, in face order
+struct ClassifiedFaces {
+    size_t capacity;
+
+    // Inside the guard band and the near and far planes, ready to be put on
+    // screen as they are
+    uint32_t *inside;
+    size_t inside_count;
+
+    // Need the clipper
+    uint32_t *clipped;
+    size_t clipped_count;
+};
+
+void classified_faces_reserve(ClassifiedFaces *out, size_t face_count);
+void classified_faces_free(ClassifiedFaces *out);
+
+// Classifies faces [begin, end) of the shape from the outcodes and clip
+// space positions of their vertices and appends the survivors to `out`.
+// Faces are dropped when all their vertices are outside one plane of the
+// view volume, when they have zero area or by `cull`.
+//
+// The winding comes from the 3x3 determinant of the (x, y, w) rows of the
+// vertices (Olano and Greer), which is twice the NDC area scaled by the
+// product of the w's. Its sign stays meaningful for faces crossing w = 0,
+// so this works ahead of clipping, for orthographic projections too.
+typedef void (*TriangleClassifyKernel)(
+    PS_MeshShape *shape,
+    int begin, int end,
+    VertexStageOutput *vertices,
+    TriangleCull cull,
+    ClassifiedFaces *out
+);
+
+void triangle_classify_scalar(
+    PS_MeshShape *shape,
+    int begin, int end,
+    VertexStageOutput *vertices,
+    TriangleCull cull,
+    ClassifiedFaces *out
+);
+
+#if defined(__x86_64__)
+#define TRIANGLE_CLASSIFY_SIMD_X86
+
+// 4 faces at a time with SSE2, 8 with AVX2. `end - begin` has to be a
+// multiple of that. Only call the AVX2 one when the CPU supports it.
+void triangle_classify_sse(
+    PS_MeshShape *shape,
+    int begin, int end,
+    VertexStageOutput *vertices,
+    TriangleCull cull,
+    ClassifiedFaces *out
+);
+void triangle_classify_avx2(
+    PS_MeshShape *shape,
+    int begin, int end,
+    VertexStageOutput *vertices,
+    TriangleCull cull,
+    ClassifiedFaces *out
+);
+#endif
+
+void triangle_classify_use_simd(bool enabled);
+
+// Classifies the faces in `ranges` into `out`, which is cleared first
+void triangle_classify_shape(
+    PS_MeshShape *shape,
+    FaceRange *ranges, size_t range_count,
+    VertexStageOutput *vertices,
+    TriangleCull cull,
+    ClassifiedFaces *out
+);
@@ -0,0 +1,166 @@
+#include "triangle_classify.h"
+
+#ifdef TRIANGLE_CLASSIFY_SIMD_X86
+
+#include <immintrin.h>
+
+#define TRIANGLE_CLASSIFY_AVX2 __attribute__((target("avx2")))
+
+#define CLIP_NEEDED (CLIP_OUTCODE_NEAR | CLIP_OUTCODE_FAR | CLIP_OUTCODE_GUARD_BAND)
+
+// Compacts the faces of a batch starting at `first` into the lists, one bit
+// per lane in the masks
+static void emit_faces(int first, int keep_mask, int clip_mask, ClassifiedFaces *out) {
+    int inside_mask = keep_mask & ~clip_mask;
+    clip_mask &= keep_mask;
+
+    while (inside_mask) {
+        int lane = __builtin_ctz(inside_mask);
+        inside_mask &= inside_mask - 1;
+
+        out->inside[out->inside_count++] = first + lane;
+    }
+
+    while (clip_mask) {
+        int lane = __builtin_ctz(clip_mask);
+        clip_mask &= clip_mask - 1;
+
+        out->clipped[out->clipped_count++] = first + lane;
+    }
+}
+
+// SECTION: SSE2
+void triangle_classify_sse(
+    PS_MeshShape *shape,
+    int begin, int end,
+    VertexStageOutput *vertices,
+    TriangleCull cull,
+    ClassifiedFaces *out
+) {
+    __m128 zero = _mm_setzero_ps();
+
+    for (int i = begin; i < end; i += 4) {
+        TinyFace *faces = &shape->faces[i];
+
+        // No gathers before AVX2
+        __m128 x[3], y[3], w[3];
+        int reject_mask = 0;
+        int clip_mask = 0;
+
+        for (int k = 0; k < 3; k++) {
+            int i0 = faces[0].indices[k];
+            int i1 = faces[1].indices[k];
+            int i2 = faces[2].indices[k];
+            int i3 = faces[3].indices[k];
+
+            x[k] = _mm_setr_ps(vertices->clip_x[i0], vertices->clip_x[i1], vertices->clip_x[i2], vertices->clip_x[i3]);
+            y[k] = _mm_setr_ps(vertices->clip_y[i0], vertices->clip_y[i1], vertices->clip_y[i2], vertices->clip_y[i3]);
+            w[k] = _mm_setr_ps(vertices->clip_w[i0], vertices->clip_w[i1], vertices->clip_w[i2], vertices->clip_w[i3]);
+        }
+
+        for (int lane = 0; lane < 4; lane++) {
+            int *indices = faces[lane].indices;
+            uint8_t a = vertices->outcodes[indices[0]];
+            uint8_t b = vertices->outcodes[indices[1]];
+            uint8_t c = vertices->outcodes[indices[2]];
+
+            reject_mask |= ((a & b & c & CLIP_OUTCODE_VIEW_VOLUME) != 0) << lane;
+            clip_mask |= (((a | b | c) & CLIP_NEEDED) != 0) << lane;
+        }
+
+        // Same operation order as the scalar kernel
+        __m128 det = _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(x[0], _mm_sub_ps(_mm_mul_ps(y[1], w[2]), _mm_mul_ps(y[2], w[1]))),
+                _mm_mul_ps(x[1], _mm_sub_ps(_mm_mul_ps(y[2], w[0]), _mm_mul_ps(y[0], w[2])))
+            ),
+            _mm_mul_ps(x[2], _mm_sub_ps(_mm_mul_ps(y[0], w[1]), _mm_mul_ps(y[1], w[0])))
+        );
+
+        int positive = _mm_movemask_ps(_mm_cmpgt_ps(det, zero));
+        int negative = _mm_movemask_ps(_mm_cmplt_ps(det, zero));
+
+        int keep_mask = positive | negative;
+        if (cull == TRIANGLE_CULL_CLOCKWISE) {
+            keep_mask &= ~negative;
+        } else if (cull == TRIANGLE_CULL_COUNTER_CLOCKWISE) {
+            keep_mask &= ~positive;
+        }
+
+        emit_faces(i, keep_mask & ~reject_mask, clip_mask, out);
+    }
+}
+// SECTION_END
+
+// SECTION: AVX2
+TRIANGLE_CLASSIFY_AVX2 void triangle_classify_avx2(
+    PS_MeshShape *shape,
+    int begin, int end,
+    VertexStageOutput *vertices,
+    TriangleCull cull,
+    ClassifiedFaces *out
+) {
+    __m256 zero = _mm256_setzero_ps();
+    __m256i byte_mask = _mm256_set1_epi32(0xff);
+    __m256i view_volume = _mm256_set1_epi32(CLIP_OUTCODE_VIEW_VOLUME);
+    __m256i clip_needed = _mm256_set1_epi32(CLIP_NEEDED);
+
+    // Offsets of the first index of 8 consecutive faces, in ints
+    __m256i face_offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+    for (int i = begin; i < end; i += 8) {
+        int *face_indices = shape->faces[i].indices;
+
+        __m256 x[3], y[3], w[3];
+        __m256i outcodes_and = view_volume;
+        __m256i outcodes_or = _mm256_setzero_si256();
+
+        for (int k = 0; k < 3; k++) {
+            __m256i indices = _mm256_i32gather_epi32(face_indices + k, face_offsets, 4);
+
+            x[k] = _mm256_i32gather_ps(vertices->clip_x, indices, 4);
+            y[k] = _mm256_i32gather_ps(vertices->clip_y, indices, 4);
+            w[k] = _mm256_i32gather_ps(vertices->clip_w, indices, 4);
+
+            // Outcodes are bytes, the slack after them covers the 3 extra
+            // bytes read for the last one
+            __m256i outcodes = _mm256_and_si256(
+                _mm256_i32gather_epi32((const int *)vertices->outcodes, indices, 1),
+                byte_mask
+            );
+
+            outcodes_and = _mm256_and_si256(outcodes_and, outcodes);
+            outcodes_or = _mm256_or_si256(outcodes_or, outcodes);
+        }
+
+        __m256i zero_i = _mm256_setzero_si256();
+        int accept_mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(outcodes_and, zero_i)));
+        int clip_mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(
+            _mm256_cmpeq_epi32(_mm256_and_si256(outcodes_or, clip_needed), zero_i)
+        )) & 0xff;
+
+        // No FMA, so results match the scalar kernel
+        __m256 det = _mm256_add_ps(
+            _mm256_add_ps(
+                _mm256_mul_ps(x[0], _mm256_sub_ps(_mm256_mul_ps(y[1], w[2]), _mm256_mul_ps(y[2], w[1]))),
+                _mm256_mul_ps(x[1], _mm256_sub_ps(_mm256_mul_ps(y[2], w[0]), _mm256_mul_ps(y[0], w[2])))
+            ),
+            _mm256_mul_ps(x[2], _mm256_sub_ps(_mm256_mul_ps(y[0], w[1]), _mm256_mul_ps(y[1], w[0])))
+        );
+
+        int positive = _mm256_movemask_ps(_mm256_cmp_ps(det, zero, _CMP_GT_OQ));
+        int negative = _mm256_movemask_ps(_mm256_cmp_ps(det, zero, _CMP_LT_OQ));
+
+        int keep_mask = positive | negative;
+        if (cull == TRIANGLE_CULL_CLOCKWISE) {
+            keep_mask &= ~negative;
+        } else if (cull == TRIANGLE_CULL_COUNTER_CLOCKWISE) {
+            keep_mask &= ~positive;
+        }
+
+        emit_faces(i, keep_mask & accept_mask, clip_mask, out);
+    }
+}
+// SECTION_END
+
+#endif
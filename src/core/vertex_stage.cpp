@@ -0,0 +1,270 @@
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "cpu_features.h"
+#include "vertex_stage.h"
+
+void vertex_stage_reserve(VertexStageOutput *out, size_t padded_count) {
+    if (padded_count <= out->capacity) {
+        return;
+    }
+
+    float **streams[] = {
+        &out->clip_x,
+        &out->clip_y,
+        &out->clip_z,
+        &out->clip_w,
+        &out->normal_x,
+        &out->normal_y,
+        &out->normal_z,
+    };
+
+    for (float **stream : streams) {
+        *stream = (float *)realloc(*stream, padded_count * sizeof(float));
+    }
+    for (int k = 0; k < VARYING_CUSTOM_SLOTS; k++) {
+        out->custom[k] = (float *)realloc(out->custom[k], padded_count * sizeof(float));
+    }
+
+    out->outcodes = (uint8_t *)realloc(out->outcodes, padded_count + VERTEX_OUTCODES_SLACK);
+    out->capacity = padded_count;
+}
+
+void vertex_stage_free(VertexStageOutput *out) {
+    free(out->clip_x);
+    free(out->clip_y);
+    free(out->clip_z);
+    free(out->clip_w);
+    free(out->normal_x);
+    free(out->normal_y);
+    free(out->normal_z);
+    for (int k = 0; k < VARYING_CUSTOM_SLOTS; k++) {
+        free(out->custom[k]);
+    }
+    free(out->outcodes);
+
+    *out = {};
+}
+
+void vertex_batch_scalar(
+    TinyVertexStreams *streams,
+    size_t begin, size_t end,
+    Matrix4 *mat_model_clip,
+    Matrix4 *mat_normal,
+    GuardBand *guard_band,
+    VertexStageOutput *out
+) {
+    Matrix4 m = *mat_model_clip;
+    Matrix4 n = *mat_normal;
+    GuardBand g = *guard_band;
+
+    for (size_t i = begin; i < end; i++) {
+        float px = streams->position_x[i];
+        float py = streams->position_y[i];
+        float pz = streams->position_z[i];
+
+        // Positions have w = 1, so the last column is added as is
+        float x = m.m0 * px + m.m4 * py + m.m8 * pz + m.m12;
+        float y = m.m1 * px + m.m5 * py + m.m9 * pz + m.m13;
+        float z = m.m2 * px + m.m6 * py + m.m10 * pz + m.m14;
+        float w = m.m3 * px + m.m7 * py + m.m11 * pz + m.m15;
+
+        out->clip_x[i] = x;
+        out->clip_y[i] = y;
+        out->clip_z[i] = z;
+        out->clip_w[i] = w;
+
+        out->outcodes[i] =
+            (x < -w ? CLIP_OUTCODE_LEFT : 0) |
+            (x > w ? CLIP_OUTCODE_RIGHT : 0) |
+            (y > w ? CLIP_OUTCODE_TOP : 0) |
+            (y < -w ? CLIP_OUTCODE_BOTTOM : 0) |
+            (z > w ? CLIP_OUTCODE_NEAR : 0) |
+            (z < -w ? CLIP_OUTCODE_FAR : 0);
+
+        float guard_x = g.x * w;
+        float guard_y = g.y * w;
+        if (x < -guard_x || x > guard_x || y < -guard_y || y > guard_y) {
+            out->outcodes[i] |= CLIP_OUTCODE_GUARD_BAND;
+        }
+
+        float nx = streams->normal_x[i];
+        float ny = streams->normal_y[i];
+        float nz = streams->normal_z[i];
+
+        // Directions have w = 0
+        out->normal_x[i] = n.m0 * nx + n.m4 * ny + n.m8 * nz;
+        out->normal_y[i] = n.m1 * nx + n.m5 * ny + n.m9 * nz;
+        out->normal_z[i] = n.m2 * nx + n.m6 * ny + n.m10 * nz;
+    }
+}
+
+static bool simd_enabled = true;
+
+static VertexBatchKernel vertex_select_batch_kernel() {
+#ifdef VERTEX_SIMD_X86
+    if (cpu_supports_avx2()) {
+        return vertex_batch_avx2;
+    }
+
+    // SSE2 is part of x86-64
+    return vertex_batch_sse;
+#else
+    return vertex_batch_scalar;
+#endif
+}
+
+VertexBatchKernel vertex_batch_kernel() {
+    static VertexBatchKernel simd_kernel = vertex_select_batch_kernel();
+
+    return simd_enabled ? simd_kernel : vertex_batch_scalar;
+}
+
+void vertex_stage_use_simd(bool enabled) {
+    simd_enabled = enabled;
+}
+
+// Hands [begin, end) to the vertex shader one batch at a time
+static void vertex_shader_run(
+    TinyVertexStreams *streams,
+    size_t begin, size_t end,
+    VertexShader vertex_shader,
+    void *uniforms,
+    VertexStageOutput *out
+) {
+    for (size_t i = begin; i < end; i += VERTEX_SHADER_BATCH) {
+        VertexBatch batch = {
+            .position_x = streams->position_x + i,
+            .position_y = streams->position_y + i,
+            .position_z = streams->position_z + i,
+            .clip_x = out->clip_x + i,
+            .clip_y = out->clip_y + i,
+            .clip_z = out->clip_z + i,
+            .clip_w = out->clip_w + i,
+            .normal_x = out->normal_x + i,
+            .normal_y = out->normal_y + i,
+            .normal_z = out->normal_z + i,
+            .custom = {},
+        };
+        for (int k = 0; k < VARYING_CUSTOM_SLOTS; k++) {
+            batch.custom[k] = out->custom[k] + i;
+        }
+
+        vertex_shader(&batch, uniforms);
+    }
+}
+
+void vertex_stage_run(
+    TinyMesh *mesh,
+    VertexRange *ranges, size_t range_count,
+    Matrix4 *mat_model_clip,
+    Matrix4 *mat_normal,
+    GuardBand *guard_band,
+    VertexShader vertex_shader,
+    void *uniforms,
+    VertexStageOutput *out
+) {
+    vertex_stage_reserve(out, mesh->streams.padded_count);
+    VertexBatchKernel kernel = vertex_batch_kernel();
+
+    size_t done = 0;
+    for (size_t i = 0; i < range_count; i++) {
+        size_t begin = ranges[i].begin / MESH_STREAM_PADDING * MESH_STREAM_PADDING;
+        size_t end = (ranges[i].end + MESH_STREAM_PADDING - 1) / MESH_STREAM_PADDING * MESH_STREAM_PADDING;
+
+        // The batch shared with the previous range is already done
+        begin = std::max(begin, done);
+        if (begin >= end) {
+            continue;
+        }
+
+        kernel(&mesh->streams, begin, end, mat_model_clip, mat_normal, guard_band, out);
+        if (vertex_shader != nullptr) {
+            vertex_shader_run(&mesh->streams, begin, end, vertex_shader, uniforms, out);
+        }
+        done = end;
+    }
+}
+
+#ifdef VERTEX_SIMD_X86
+// Deterministic values in [-range, range)
+static float test_random(uint32_t *state, float range) {
+    *state = *state * 1664525u + 1013904223u;
+    return ((*state >> 8) / 16777216.f * 2.f - 1.f) * range;
+}
+
+static bool test_streams_equal(const float *a, const float *b, size_t count) {
+    return memcmp(a, b, count * sizeof(float)) == 0;
+}
+
+TEST_CASE("vertex batch kernels match the scalar one bit for bit") {
+    const size_t count = 64;
+    uint32_t seed = 1;
+
+    // Positions around the camera, so they fall on both sides of every
+    // plane and of the guard band
+    std::vector<float> values[6];
+    for (int k = 0; k < 6; k++) {
+        values[k].resize(count);
+        for (size_t i = 0; i < count; i++) {
+            values[k][i] = test_random(&seed, 6.f);
+        }
+    }
+
+    TinyVertexStreams streams = {
+        .padded_count = count,
+        .position_x = values[0].data(),
+        .position_y = values[1].data(),
+        .position_z = values[2].data(),
+        .normal_x = values[3].data(),
+        .normal_y = values[4].data(),
+        .normal_z = values[5].data(),
+    };
+
+    Matrix4 mat_model_clip = mat4_multiply(
+        mat4_get_world({ 1, 1, 1 }, { 0.3f, 0.7f, 0.1f }, { 0, 0, -4 }),
+        mat4_get_perspective_projection(0.75f, 1.2f, -0.1f, -20.f)
+    );
+    Matrix4 mat_normal = mat4_get_rotation(0.3f, 0.7f, 0.1f);
+    GuardBand guard_band = { 1.5f, 1.25f };
+
+    VertexStageOutput expected = {};
+    vertex_stage_reserve(&expected, count);
+    vertex_batch_scalar(&streams, 0, count, &mat_model_clip, &mat_normal, &guard_band, &expected);
+
+    size_t outside = 0;
+    for (size_t i = 0; i < count; i++) {
+        outside += expected.outcodes[i] != 0;
+    }
+    REQUIRE(outside > 0);
+    REQUIRE(outside < count);
+
+    std::vector<VertexBatchKernel> kernels = { vertex_batch_sse };
+    if (cpu_supports_avx2()) {
+        kernels.push_back(vertex_batch_avx2);
+    }
+
+    for (VertexBatchKernel kernel : kernels) {
+        VertexStageOutput out = {};
+        vertex_stage_reserve(&out, count);
+        kernel(&streams, 0, count, &mat_model_clip, &mat_normal, &guard_band, &out);
+
+        CHECK(test_streams_equal(out.clip_x, expected.clip_x, count));
+        CHECK(test_streams_equal(out.clip_y, expected.clip_y, count));
+        CHECK(test_streams_equal(out.clip_z, expected.clip_z, count));
+        CHECK(test_streams_equal(out.clip_w, expected.clip_w, count));
+        CHECK(test_streams_equal(out.normal_x, expected.normal_x, count));
+        CHECK(test_streams_equal(out.normal_y, expected.normal_y, count));
+        CHECK(test_streams_equal(out.normal_z, expected.normal_z, count));
+        CHECK(memcmp(out.outcodes, expected.outcodes, count) == 0);
+
+        vertex_stage_free(&out);
+    }
+
+    vertex_stage_free(&expected);
+}
+#endif
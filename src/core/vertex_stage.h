@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "clipping.h"
+#include "matrix.h"
+#include "mesh.h"
+
+// Output of the vertex stage, one entry per mesh vertex, read back by
+// primitive assembly through TinyFace::indices
+struct VertexStageOutput {
+    size_t capacity;
+
+    // Clip space, before the perspective divide
+    float *clip_x;
+    float *clip_y;
+    float *clip_z;
+    float *clip_w;
+
+    float *normal_x;
+    float *normal_y;
+    float *normal_z;
+
+    // Written by the vertex shader, see VertexBatch
+    float *custom[VARYING_CUSTOM_SLOTS];
+
+    // ClipOutcode bits, followed by VERTEX_OUTCODES_SLACK bytes of
+    // padding so they can be gathered 4 bytes at a time
+    uint8_t *outcodes;
+};
+
+#define VERTEX_OUTCODES_SLACK 3
+
+// Vertices a vertex shader is called with at once. Batches are aligned to
+// the stream padding, so they are always whole.
+#define VERTEX_SHADER_BATCH MESH_STREAM_PADDING
+
+// A batch of the vertex stage as seen by a vertex shader: every pointer is
+// to the first of VERTEX_SHADER_BATCH entries of a stream. Loops over the
+// batch have a fixed trip count, so the compiler can vectorize them.
+struct VertexBatch {
+    // Model space inputs
+    const float *position_x;
+    const float *position_y;
+    const float *position_z;
+
+    // Clip space, from the fixed transform. The outcodes are computed from
+    // them before the shader runs, so they are read only.
+    const float *clip_x;
+    const float *clip_y;
+    const float *clip_z;
+    const float *clip_w;
+
+    // Transformed by the normal matrix, the shader may replace them
+    float *normal_x;
+    float *normal_y;
+    float *normal_z;
+
+    // FRAGMENT_VARYING_CUSTOM slots, for the shader to fill in
+    float *custom[VARYING_CUSTOM_SLOTS];
+};
+
+// Runs per batch rather than per vertex, so its cost is one call for every
+// VERTEX_SHADER_BATCH vertices
+typedef void (*VertexShader)(VertexBatch *batch, void *uniforms);
+
+// Grows the output to hold the vertices of a mesh with `padded_count`
+// stream entries
+void vertex_stage_reserve(VertexStageOutput *out, size_t padded_count);
+void vertex_stage_free(VertexStageOutput *out);
+
+// Transforms stream entries [begin, end), both multiples of
+// MESH_STREAM_PADDING: positions by `mat_model_clip` into clip space along
+// with their outcodes, normals by `mat_normal`. CLIP_OUTCODE_GUARD_BAND is
+// set for positions outside of `guard_band`.
+typedef void (*VertexBatchKernel)(
+    TinyVertexStreams *streams,
+    size_t begin, size_t end,
+    Matrix4 *mat_model_clip,
+    Matrix4 *mat_normal,
+    GuardBand *guard_band,
+    VertexStageOutput *out
+);
+
+void vertex_batch_scalar(
+    TinyVertexStreams *streams,
+    size_t begin, size_t end,
+    Matrix4 *mat_model_clip,
+    Matrix4 *mat_normal,
+    GuardBand *guard_band,
+    VertexStageOutput *out
+);
+
+#if defined(__x86_64__)
+#define VERTEX_SIMD_X86
+
+// 4 vertices at a time with SSE2, 8 with AVX2. Same results as the scalar
+// kernel, bit for bit. Only call the AVX2 one when the CPU supports it.
+void vertex_batch_sse(
+    TinyVertexStreams *streams,
+    size_t begin, size_t end,
+    Matrix4 *mat_model_clip,
+    Matrix4 *mat_normal,
+    GuardBand *guard_band,
+    VertexStageOutput *out
+);
+void vertex_batch_avx2(
+    TinyVertexStreams *streams,
+    size_t begin, size_t end,
+    Matrix4 *mat_model_clip,
+    Matrix4 *mat_normal,
+    GuardBand *guard_band,
+    VertexStageOutput *out
+);
+#endif
+
+// Returns the fastest kernel the CPU supports, or the scalar one when SIMD
+// is disabled
+VertexBatchKernel vertex_batch_kernel();
+void vertex_stage_use_simd(bool enabled);
+
+// Runs the vertex stage over the vertices of the mesh in `ranges`, which
+// are in increasing order. Ranges are widened to whole batches, see
+// VertexBatchKernel. When given, `vertex_shader` runs over every batch
+// after the transform, with `uniforms`.
+void vertex_stage_run(
+    TinyMesh *mesh,
+    VertexRange *ranges, size_t range_count,
+    Matrix4 *mat_model_clip,
+    Matrix4 *mat_normal,
+    GuardBand *guard_band,
+    VertexShader vertex_shader,
+    void *uniforms,
+    VertexStageOutput *out
+);
@@ -0,0 +1,167 @@
+#include "vertex_stage.h"
+
+#ifdef VERTEX_SIMD_X86
+
+#include <immintrin.h>
+
+#define VERTEX_AVX2 __attribute__((target("avx2")))
+
+// SECTION: SSE2
+// Outcode bits of 4 vertices, one per int32 lane
+static __m128i outcodes_sse(__m128 x, __m128 y, __m128 z, __m128 w, GuardBand *guard_band) {
+    __m128 neg_w = _mm_xor_ps(w, _mm_set1_ps(-0.f));
+
+    __m128 left = _mm_and_ps(_mm_cmplt_ps(x, neg_w), _mm_castsi128_ps(_mm_set1_epi32(CLIP_OUTCODE_LEFT)));
+    __m128 right = _mm_and_ps(_mm_cmpgt_ps(x, w), _mm_castsi128_ps(_mm_set1_epi32(CLIP_OUTCODE_RIGHT)));
+    __m128 top = _mm_and_ps(_mm_cmpgt_ps(y, w), _mm_castsi128_ps(_mm_set1_epi32(CLIP_OUTCODE_TOP)));
+    __m128 bottom = _mm_and_ps(_mm_cmplt_ps(y, neg_w), _mm_castsi128_ps(_mm_set1_epi32(CLIP_OUTCODE_BOTTOM)));
+    __m128 near_plane = _mm_and_ps(_mm_cmpgt_ps(z, w), _mm_castsi128_ps(_mm_set1_epi32(CLIP_OUTCODE_NEAR)));
+    __m128 far_plane = _mm_and_ps(_mm_cmplt_ps(z, neg_w), _mm_castsi128_ps(_mm_set1_epi32(CLIP_OUTCODE_FAR)));
+
+    __m128 guard_x = _mm_mul_ps(_mm_set1_ps(guard_band->x), w);
+    __m128 guard_y = _mm_mul_ps(_mm_set1_ps(guard_band->y), w);
+    __m128 neg_guard_x = _mm_xor_ps(guard_x, _mm_set1_ps(-0.f));
+    __m128 neg_guard_y = _mm_xor_ps(guard_y, _mm_set1_ps(-0.f));
+    __m128 guard = _mm_and_ps(
+        _mm_or_ps(
+            _mm_or_ps(_mm_cmplt_ps(x, neg_guard_x), _mm_cmpgt_ps(x, guard_x)),
+            _mm_or_ps(_mm_cmplt_ps(y, neg_guard_y), _mm_cmpgt_ps(y, guard_y))
+        ),
+        _mm_castsi128_ps(_mm_set1_epi32(CLIP_OUTCODE_GUARD_BAND))
+    );
+
+    return _mm_castps_si128(_mm_or_ps(
+        _mm_or_ps(_mm_or_ps(left, right), _mm_or_ps(top, bottom)),
+        _mm_or_ps(_mm_or_ps(near_plane, far_plane), guard)
+    ));
+}
+
+void vertex_batch_sse(
+    TinyVertexStreams *streams,
+    size_t begin, size_t end,
+    Matrix4 *mat_model_clip,
+    Matrix4 *mat_normal,
+    GuardBand *guard_band,
+    VertexStageOutput *out
+) {
+    Matrix4 m = *mat_model_clip;
+    Matrix4 n = *mat_normal;
+
+    // Same operation order as the scalar kernel, so results match
+    #define ROW(c0, c1, c2, a, b, c) \
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(c0), a), _mm_mul_ps(_mm_set1_ps(c1), b)), _mm_mul_ps(_mm_set1_ps(c2), c))
+
+    for (size_t i = begin; i < end; i += 4) {
+        __m128 px = _mm_loadu_ps(streams->position_x + i);
+        __m128 py = _mm_loadu_ps(streams->position_y + i);
+        __m128 pz = _mm_loadu_ps(streams->position_z + i);
+
+        __m128 x = _mm_add_ps(ROW(m.m0, m.m4, m.m8, px, py, pz), _mm_set1_ps(m.m12));
+        __m128 y = _mm_add_ps(ROW(m.m1, m.m5, m.m9, px, py, pz), _mm_set1_ps(m.m13));
+        __m128 z = _mm_add_ps(ROW(m.m2, m.m6, m.m10, px, py, pz), _mm_set1_ps(m.m14));
+        __m128 w = _mm_add_ps(ROW(m.m3, m.m7, m.m11, px, py, pz), _mm_set1_ps(m.m15));
+
+        _mm_storeu_ps(out->clip_x + i, x);
+        _mm_storeu_ps(out->clip_y + i, y);
+        _mm_storeu_ps(out->clip_z + i, z);
+        _mm_storeu_ps(out->clip_w + i, w);
+
+        __m128i codes = outcodes_sse(x, y, z, w, guard_band);
+        codes = _mm_packs_epi32(codes, codes);
+        codes = _mm_packus_epi16(codes, codes);
+        int packed = _mm_cvtsi128_si32(codes);
+        __builtin_memcpy(out->outcodes + i, &packed, 4);
+
+        __m128 nx = _mm_loadu_ps(streams->normal_x + i);
+        __m128 ny = _mm_loadu_ps(streams->normal_y + i);
+        __m128 nz = _mm_loadu_ps(streams->normal_z + i);
+
+        _mm_storeu_ps(out->normal_x + i, ROW(n.m0, n.m4, n.m8, nx, ny, nz));
+        _mm_storeu_ps(out->normal_y + i, ROW(n.m1, n.m5, n.m9, nx, ny, nz));
+        _mm_storeu_ps(out->normal_z + i, ROW(n.m2, n.m6, n.m10, nx, ny, nz));
+    }
+
+    #undef ROW
+}
+// SECTION_END
+
+// SECTION: AVX2
+VERTEX_AVX2 static __m256i outcodes_avx2(__m256 x, __m256 y, __m256 z, __m256 w, GuardBand *guard_band) {
+    __m256 neg_w = _mm256_xor_ps(w, _mm256_set1_ps(-0.f));
+
+    __m256 left = _mm256_and_ps(_mm256_cmp_ps(x, neg_w, _CMP_LT_OQ), _mm256_castsi256_ps(_mm256_set1_epi32(CLIP_OUTCODE_LEFT)));
+    __m256 right = _mm256_and_ps(_mm256_cmp_ps(x, w, _CMP_GT_OQ), _mm256_castsi256_ps(_mm256_set1_epi32(CLIP_OUTCODE_RIGHT)));
+    __m256 top = _mm256_and_ps(_mm256_cmp_ps(y, w, _CMP_GT_OQ), _mm256_castsi256_ps(_mm256_set1_epi32(CLIP_OUTCODE_TOP)));
+    __m256 bottom = _mm256_and_ps(_mm256_cmp_ps(y, neg_w, _CMP_LT_OQ), _mm256_castsi256_ps(_mm256_set1_epi32(CLIP_OUTCODE_BOTTOM)));
+    __m256 near_plane = _mm256_and_ps(_mm256_cmp_ps(z, w, _CMP_GT_OQ), _mm256_castsi256_ps(_mm256_set1_epi32(CLIP_OUTCODE_NEAR)));
+    __m256 far_plane = _mm256_and_ps(_mm256_cmp_ps(z, neg_w, _CMP_LT_OQ), _mm256_castsi256_ps(_mm256_set1_epi32(CLIP_OUTCODE_FAR)));
+
+    __m256 guard_x = _mm256_mul_ps(_mm256_set1_ps(guard_band->x), w);
+    __m256 guard_y = _mm256_mul_ps(_mm256_set1_ps(guard_band->y), w);
+    __m256 neg_guard_x = _mm256_xor_ps(guard_x, _mm256_set1_ps(-0.f));
+    __m256 neg_guard_y = _mm256_xor_ps(guard_y, _mm256_set1_ps(-0.f));
+    __m256 guard = _mm256_and_ps(
+        _mm256_or_ps(
+            _mm256_or_ps(_mm256_cmp_ps(x, neg_guard_x, _CMP_LT_OQ), _mm256_cmp_ps(x, guard_x, _CMP_GT_OQ)),
+            _mm256_or_ps(_mm256_cmp_ps(y, neg_guard_y, _CMP_LT_OQ), _mm256_cmp_ps(y, guard_y, _CMP_GT_OQ))
+        ),
+        _mm256_castsi256_ps(_mm256_set1_epi32(CLIP_OUTCODE_GUARD_BAND))
+    );
+
+    return _mm256_castps_si256(_mm256_or_ps(
+        _mm256_or_ps(_mm256_or_ps(left, right), _mm256_or_ps(top, bottom)),
+        _mm256_or_ps(_mm256_or_ps(near_plane, far_plane), guard)
+    ));
+}
+
+VERTEX_AVX2 void vertex_batch_avx2(
+    TinyVertexStreams *streams,
+    size_t begin, size_t end,
+    Matrix4 *mat_model_clip,
+    Matrix4 *mat_normal,
+    GuardBand *guard_band,
+    VertexStageOutput *out
+) {
+    Matrix4 m = *mat_model_clip;
+    Matrix4 n = *mat_normal;
+
+    // No FMA, so results match the scalar kernel
+    #define ROW(c0, c1, c2, a, b, c) \
+        _mm256_add_ps( \
+            _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(c0), a), _mm256_mul_ps(_mm256_set1_ps(c1), b)), \
+            _mm256_mul_ps(_mm256_set1_ps(c2), c) \
+        )
+
+    for (size_t i = begin; i < end; i += 8) {
+        __m256 px = _mm256_loadu_ps(streams->position_x + i);
+        __m256 py = _mm256_loadu_ps(streams->position_y + i);
+        __m256 pz = _mm256_loadu_ps(streams->position_z + i);
+
+        __m256 x = _mm256_add_ps(ROW(m.m0, m.m4, m.m8, px, py, pz), _mm256_set1_ps(m.m12));
+        __m256 y = _mm256_add_ps(ROW(m.m1, m.m5, m.m9, px, py, pz), _mm256_set1_ps(m.m13));
+        __m256 z = _mm256_add_ps(ROW(m.m2, m.m6, m.m10, px, py, pz), _mm256_set1_ps(m.m14));
+        __m256 w = _mm256_add_ps(ROW(m.m3, m.m7, m.m11, px, py, pz), _mm256_set1_ps(m.m15));
+
+        _mm256_storeu_ps(out->clip_x + i, x);
+        _mm256_storeu_ps(out->clip_y + i, y);
+        _mm256_storeu_ps(out->clip_z + i, z);
+        _mm256_storeu_ps(out->clip_w + i, w);
+
+        __m256i codes = outcodes_avx2(x, y, z, w, guard_band);
+        __m128i codes_16 = _mm_packs_epi32(_mm256_castsi256_si128(codes), _mm256_extracti128_si256(codes, 1));
+        _mm_storel_epi64((__m128i *)(out->outcodes + i), _mm_packus_epi16(codes_16, codes_16));
+
+        __m256 nx = _mm256_loadu_ps(streams->normal_x + i);
+        __m256 ny = _mm256_loadu_ps(streams->normal_y + i);
+        __m256 nz = _mm256_loadu_ps(streams->normal_z + i);
+
+        _mm256_storeu_ps(out->normal_x + i, ROW(n.m0, n.m4, n.m8, nx, ny, nz));
+        _mm256_storeu_ps(out->normal_y + i, ROW(n.m1, n.m5, n.m9, nx, ny, nz));
+        _mm256_storeu_ps(out->normal_z + i, ROW(n.m2, n.m6, n.m10, nx, ny, nz));
+    }
+
+    #undef ROW
+}
+// SECTION_END
+
+#endif
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "visibility_buffer.h"
+
+// Resolve jobs cover this many rows each
+#define VISIBILITY_RESOLVE_ROWS 16
+
+VisibilityBuffer *visibility_buffer_create(int width, int height) {
+    VisibilityBuffer *visibility_buffer = (VisibilityBuffer *)malloc(sizeof(VisibilityBuffer));
+    if (!visibility_buffer) {
+        return nullptr;
+    }
+
+    visibility_buffer->width = width;
+    visibility_buffer->height = height;
+    visibility_buffer->ids = (uint32_t *)malloc(width * height * sizeof(uint32_t));
+
+    if (!visibility_buffer->ids) {
+        free(visibility_buffer);
+        return nullptr;
+    }
+
+    visibility_buffer_clear(visibility_buffer);
+
+    return visibility_buffer;
+}
+
+void visibility_buffer_destroy(VisibilityBuffer *visibility_buffer) {
+    free(visibility_buffer->ids);
+    free(visibility_buffer);
+}
+
+void visibility_buffer_clear(VisibilityBuffer *visibility_buffer) {
+    size_t size = visibility_buffer->width * visibility_buffer->height;
+
+    for (size_t i = 0; i < size; i++) {
+        visibility_buffer->ids[i] = VISIBILITY_NO_TRIANGLE;
+    }
+}
+
+// A face set up for shading. Barycentrics come from homogeneous 2D
+// rasterization (Olano and Greer): with clip space vertices C_i = (x, y, w),
+// the point seen at NDC p = (x, y, 1) has weights proportional to
+// (C_j x C_k) . p. They are perspective correct as they are, and stay valid
+// for faces the near plane clipped in the raster pass.
+struct ResolveFace {
+    uint32_t triangle_id;
+
+    Vec3f weight_rows[3];
+    TinyVertex vertices[3];
+};
+
+static void resolve_face_setup(VisibilityScene *scene, uint32_t triangle_id, ResolveFace *out) {
+    TinyMesh *mesh = &scene->meshes[triangle_id_mesh(triangle_id)];
+    VisibilityMeshTransform *transform = &scene->transforms[triangle_id_mesh(triangle_id)];
+    TinyFace *face = &mesh->shapes[triangle_id_shape(triangle_id)].faces[triangle_id_face(triangle_id)];
+
+    Vec3f clip[3];
+    for (int i = 0; i < 3; i++) {
+        TinyVertex *vertex = &mesh->vertices[face->indices[i]];
+        Vec4f position = mat4_multiply_vec4(transform->mat_model_clip, vertex->position);
+
+        clip[i] = { position.x, position.y, position.w };
+
+        out->vertices[i] = *vertex;
+        out->vertices[i].normal = vec3_from_vec4(mat4_multiply_vec4(
+            transform->mat_normal,
+            vec4_from_vec3(vertex->normal, false)
+        ));
+    }
+
+    out->weight_rows[0] = Vec3f::cross(clip[1], clip[2]);
+    out->weight_rows[1] = Vec3f::cross(clip[2], clip[0]);
+    out->weight_rows[2] = Vec3f::cross(clip[0], clip[1]);
+    out->triangle_id = triangle_id;
+}
+
+struct VisibilityResolveJob {
+    VisibilityBuffer *visibility_buffer;
+    VisibilityScene *scene;
+    DepthBuffer *depth_buffer;
+    ColorBuffer *color_buffer;
+    FragmentShader fragment_shader;
+    void *uniforms;
+};
+
+static void visibility_buffer_resolve_rows(void *data, size_t job_idx) {
+    VisibilityResolveJob *job = static_cast<VisibilityResolveJob *>(data);
+    VisibilityBuffer *visibility_buffer = job->visibility_buffer;
+
+    // Same viewport transform as the raster pass
+    int half_width = visibility_buffer->width / 2;
+    int half_height = visibility_buffer->height / 2;
+
+    int y_start = job_idx * VISIBILITY_RESOLVE_ROWS;
+    int y_end = std::min(visibility_buffer->height, y_start + VISIBILITY_RESOLVE_ROWS);
+
+    // Neighbouring pixels mostly show the same face, so it's only set up
+    // again when the id changes
+    ResolveFace face;
+    face.triangle_id = VISIBILITY_NO_TRIANGLE;
+
+    for (int y = y_start; y < y_end; y++) {
+        for (int x = 0; x < visibility_buffer->width; x++) {
+            int idx = y * visibility_buffer->width + x;
+            uint32_t triangle_id = visibility_buffer->ids[idx];
+
+            if (triangle_id == VISIBILITY_NO_TRIANGLE) {
+                continue;
+            }
+
+            if (triangle_id != face.triangle_id) {
+                resolve_face_setup(job->scene, triangle_id, &face);
+            }
+
+            Vec3f ndc = {
+                (float)(x - half_width) / half_width,
+                (float)(y - half_height) / half_height,
+                1.f
+            };
+
+            float weights[3];
+            float weight_sum = 0;
+            for (int i = 0; i < 3; i++) {
+                weights[i] = Vec3f::dot(face.weight_rows[i], ndc);
+                weight_sum += weights[i];
+            }
+
+            if (weight_sum == 0.f) {
+                continue;
+            }
+
+            FragmentData fragment = {
+                .depth = job->depth_buffer->data[idx],
+                .u = 0,
+                .v = 0,
+                .normal = { 0, 0, 0 },
+                .custom = {},
+                .material_id = triangle_id_material(triangle_id),
+            };
+
+            for (int i = 0; i < 3; i++) {
+                TinyVertex *vertex = &face.vertices[i];
+                float weight = weights[i] / weight_sum;
+
+                fragment.u += vertex->texcoords.x * weight;
+                fragment.v += vertex->texcoords.y * weight;
+                fragment.normal.x += vertex->normal.x * weight;
+                fragment.normal.y += vertex->normal.y * weight;
+                fragment.normal.z += vertex->normal.z * weight;
+            }
+
+            job->color_buffer->set_pixel(x, y, job->fragment_shader(&fragment, job->uniforms));
+        }
+    }
+}
+
+void visibility_buffer_resolve(
+    VisibilityBuffer *visibility_buffer,
+    VisibilityScene *scene,
+    DepthBuffer *depth_buffer,
+    ColorBuffer *color_buffer,
+    FragmentShader fragment_shader,
+    void *uniforms,
+    JobPool *pool
+) {
+    VisibilityResolveJob job = {
+        .visibility_buffer = visibility_buffer,
+        .scene = scene,
+        .depth_buffer = depth_buffer,
+        .color_buffer = color_buffer,
+        .fragment_shader = fragment_shader,
+        .uniforms = uniforms,
+    };
+
+    size_t job_count = (visibility_buffer->height + VISIBILITY_RESOLVE_ROWS - 1) / VISIBILITY_RESOLVE_ROWS;
+
+    if (pool != nullptr) {
+        job_pool_run(pool, visibility_buffer_resolve_rows, &job, job_count);
+    } else {
+        for (size_t i = 0; i < job_count; i++) {
+            visibility_buffer_resolve_rows(&job, i);
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "color_buffer.h"
+#include "depth_buffer.h"
+#include "job_pool.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "shader.h"
+
+// Id of pixels no triangle was written to
+#define VISIBILITY_NO_TRIANGLE UINT32_MAX
+
+// Visibility buffer rendering: the raster pass only writes depth and the
+// triangle id of every pixel, see triangle_id_make. visibility_buffer_resolve
+// then looks the faces up again and shades every pixel once.
+struct VisibilityBuffer {
+    int width;
+    int height;
+    uint32_t *ids;
+};
+
+// How a mesh was drawn, so the resolve can put its faces back on screen
+struct VisibilityMeshTransform {
+    // Model space -> clip space, before the perspective divide
+    Matrix4 mat_model_clip;
+    // Model space normals -> the space the fragment shader lights in
+    Matrix4 mat_normal;
+};
+
+struct VisibilityScene {
+    TinyMesh *meshes;
+    // One per mesh
+    VisibilityMeshTransform *transforms;
+};
+
+VisibilityBuffer *visibility_buffer_create(int width, int height);
+void visibility_buffer_destroy(VisibilityBuffer *visibility_buffer);
+
+void visibility_buffer_clear(VisibilityBuffer *visibility_buffer);
+
+// Shades every written pixel and stores the result in the color buffer.
+// Fragments get the depth from `depth_buffer` and attributes interpolated
+// from the face vertices. Pixels nothing was written to keep their color.
+void visibility_buffer_resolve(
+    VisibilityBuffer *visibility_buffer,
+    VisibilityScene *scene,
+    DepthBuffer *depth_buffer,
+    ColorBuffer *color_buffer,
+    FragmentShader fragment_shader,
+    void *uniforms,
+    JobPool *pool = nullptr
+);
@@ -11,9 +11,16 @@
 #include "../core/shader.h"
 #include "../core/clipping.h"
 #include "../core/display.h"
+#include "../core/gl.h"
 #include "../core/matrix.h"
 #include "../core/tiny_math.h"
+#include "../core/job_pool.h"
 #include "../core/ps_array.h"
+#include "../core/raster.h"
+#include "../core/raster_kernels.h"
+#include "../core/tile_renderer.h"
+#include "../core/triangle_classify.h"
+#include "../core/vertex_stage.h"
 
 #include "../tooling/logger.h"
 #include "../tooling/render_debug_text.h"
@@ -27,6 +34,9 @@
 #define ROTATION_SPEED 0.2f
 #define Z_NEAR -0.1f
 #define Z_FAR -300.0f
+// How far past the screen edges triangles may reach before they're clipped
+// against the side planes, 0 clips at the edges
+#define GUARD_BAND_PIXELS 1024
 
 static float camera_fov_y = 60 * DEG2RAD;
 static float aspect_ratio = 1; // Gets calculated from color buffer size later
@@ -36,10 +46,7 @@ static Color light_color = {200, 20, 180, 255};
 static DepthBuffer *depth_buffer_light;
 
 static PSCameraPerspective camera_perspective;
-static Plane clipping_planes_persp[6];
-
 static PSCameraOthographic camera_orthographic;
-static Plane clipping_planes_ortho[6];
 
 inline float clamp(float val, float min_val, float max_val) {
     if (val < min_val) return min_val;
@@ -47,15 +54,91 @@ inline float clamp(float val, float min_val, float max_val) {
     return val;
 }
 
-// TODO: this should live in the gl program state
+// Uniform block of the lit passes. Filled in once per frame, before the
+// draws it is bound to, and only read by the shaders after that.
 struct Uniforms {
+    // Normalized, in view space
     Vec3f light_dir;
+
+    // The surface color as floats, and how far each channel is from white,
+    // so that shading doesn't convert them for every fragment
+    Vec3f color;
+    Vec3f color_to_white;
+    unsigned char alpha;
+
+    // For the diffuse textures, see material_texture
+    TinyMesh *meshes;
 };
 
+static Uniforms uniforms_make(Vec3f light_dir, Color color, TinyMesh *meshes) {
+    light_dir.normalize();
+
+    return {
+        .light_dir = light_dir,
+        .color = { (float)color.r, (float)color.g, (float)color.b },
+        .color_to_white = { 255.f - color.r, 255.f - color.g, 255.f - color.b },
+        .alpha = color.a,
+        .meshes = meshes,
+    };
+}
 
-static Uniforms uniforms = {};
+// clamp, except that NaN gives `min_val`. Packet shaders clamp with this,
+// their inactive lanes may hold anything.
+inline float clamp_lane(float val, float min_val, float max_val) {
+    return val > min_val ? (val < max_val ? val : max_val) : min_val;
+}
 
-Color fragment_shader_depth(void *data, void *uniforms) {
+// ColorBrightness of a color given as floats, same results
+inline Color color_brightness_of(Vec3f color, Vec3f color_to_white, unsigned char alpha, float factor) {
+    factor = clamp_lane(factor, -1.f, 1.f);
+
+    Vec3f c;
+    if (factor < 0.f) {
+        float scale = 1.f + factor;
+        c = { color.x * scale, color.y * scale, color.z * scale };
+    } else {
+        c = {
+            color_to_white.x * factor + color.x,
+            color_to_white.y * factor + color.y,
+            color_to_white.z * factor + color.z,
+        };
+    }
+
+    return { (unsigned char)c.x, (unsigned char)c.y, (unsigned char)c.z, alpha };
+}
+
+inline Color color_brightness(Uniforms *u, float factor) {
+    return color_brightness_of(u->color, u->color_to_white, u->alpha, factor);
+}
+
+// Diffuse texture of a material: the mesh texture with the shape's index,
+// if the mesh has that many, see ps_load_mesh
+static Image *material_texture(Uniforms *u, uint32_t material_id) {
+    uint32_t triangle_id = material_id << TRIANGLE_ID_FACE_BITS;
+    TinyMesh *mesh = &u->meshes[triangle_id_mesh(triangle_id)];
+    uint32_t shape_idx = triangle_id_shape(triangle_id);
+
+    return shape_idx < mesh->textures.size() ? &mesh->textures[shape_idx] : nullptr;
+}
+
+// Nearest texel, texture coordinates are clamped to [0, 1]. The G-buffer
+// relies on that, it only keeps that range.
+inline Color texture_texel(Image *texture, float u, float v) {
+    int x = clamp_lane(u, 0.f, 1.f) * (texture->width - 1);
+    int y = clamp_lane(v, 0.f, 1.f) * (texture->height - 1);
+
+    return ((Color *)texture->data)[y * texture->width + x];
+}
+
+// The texel lit like fragment_shader_main
+inline Color texel_brightness(Color texel, float factor) {
+    Vec3f color = { (float)texel.r, (float)texel.g, (float)texel.b };
+    Vec3f color_to_white = { 255.f - texel.r, 255.f - texel.g, 255.f - texel.b };
+
+    return color_brightness_of(color, color_to_white, texel.a, factor);
+}
+
+Color fragment_shader_depth(void *data, [[maybe_unused]] void *uniforms) {
     FragmentData* fd = static_cast<FragmentData*>(data);
     float depth_color_float = fd->depth * 255;
     uint8_t depth_color = round(clamp(depth_color_float, 0.0, 255.0));
@@ -66,135 +149,333 @@ Color fragment_shader_depth(void *data, void *uniforms) {
 
 Color fragment_shader_main(void* data, void *_uniforms) {
     FragmentData* fd = static_cast<FragmentData*>(data);
-    Vec3f normal = fd->normal;
-    float depth_value = fd->depth;
+    Uniforms *u = static_cast<Uniforms *>(_uniforms);
 
+    float brightness = -Vec3f::dot(u->light_dir, fd->normal);
+    return color_brightness(u, brightness);
+}
 
-    float brightness = -Vec3f::dot(uniforms.light_dir.normalize(), normal);
-    return ColorBrightness(default_color, brightness);
+// Same lighting as fragment_shader_main, but per vertex. The brightness
+// goes to custom slot 0 and is interpolated across the face.
+void vertex_shader_gouraud(VertexBatch *batch, void *_uniforms) {
+    Uniforms *u = static_cast<Uniforms *>(_uniforms);
+    Vec3f light_dir = u->light_dir;
+
+    for (int i = 0; i < VERTEX_SHADER_BATCH; i++) {
+        batch->custom[0][i] = -(
+            light_dir.x * batch->normal_x[i] +
+            light_dir.y * batch->normal_y[i] +
+            light_dir.z * batch->normal_z[i]
+        );
+    }
 }
 
-inline Vec4f transform_model_view(Vec4f in, Matrix4 *mat_world, Matrix4 *mat_view) {
-    Vec4f out = mat4_multiply_vec4(
-        *mat_world,
-        in
-    );
+Color fragment_shader_gouraud(void *data, void *_uniforms) {
+    FragmentData* fd = static_cast<FragmentData*>(data);
+    Uniforms *u = static_cast<Uniforms *>(_uniforms);
 
-    out = mat4_multiply_vec4(
-        *mat_view,
-        out
-    );
+    return color_brightness(u, fd->custom[0]);
+}
 
-    return out;
-};
+// Lit like fragment_shader_main, with the color from the shape's diffuse
+// texture. Shapes without one get the uniform color.
+Color fragment_shader_textured(void *data, void *_uniforms) {
+    FragmentData* fd = static_cast<FragmentData*>(data);
+    Uniforms *u = static_cast<Uniforms *>(_uniforms);
+
+    float brightness = -Vec3f::dot(u->light_dir, fd->normal);
+
+    Image *texture = material_texture(u, fd->material_id);
+    if (texture == nullptr) {
+        return color_brightness(u, brightness);
+    }
+
+    return texel_brightness(texture_texel(texture, fd->u, fd->v), brightness);
+}
+
+// SECTION: Packet shaders
+// The shaders above over a packet of fragments at a time, for the SIMD
+// raster kernels. Every lane gets the same color as the scalar shader.
+
+// The depth pass binds no uniforms
+void fragment_packet_depth(
+    FragmentPacket *packet,
+    [[maybe_unused]] uint32_t mask,
+    [[maybe_unused]] void *uniforms,
+    Color *colors
+) {
+    for (int i = 0; i < FRAGMENT_PACKET_SIZE; i++) {
+        float depth_color_float = packet->depth[i] * 255;
+        uint8_t depth_color = roundf(clamp_lane(depth_color_float, 0.f, 255.f));
+
+        colors[i] = { depth_color, 0, 0, 255 };
+    }
+}
+
+// -dot(light_dir, normal) of every lane
+inline void packet_lambert(FragmentPacket *packet, Vec3f light_dir, float *brightness) {
+    for (int i = 0; i < FRAGMENT_PACKET_SIZE; i++) {
+        brightness[i] = -(
+            light_dir.x * packet->normal_x[i] +
+            light_dir.y * packet->normal_y[i] +
+            light_dir.z * packet->normal_z[i]
+        );
+    }
+}
+
+void fragment_packet_main(FragmentPacket *packet, [[maybe_unused]] uint32_t mask, void *_uniforms, Color *colors) {
+    Uniforms *u = static_cast<Uniforms *>(_uniforms);
+
+    float brightness[FRAGMENT_PACKET_SIZE];
+    packet_lambert(packet, u->light_dir, brightness);
+
+    for (int i = 0; i < FRAGMENT_PACKET_SIZE; i++) {
+        colors[i] = color_brightness(u, brightness[i]);
+    }
+}
+
+void fragment_packet_gouraud(FragmentPacket *packet, [[maybe_unused]] uint32_t mask, void *_uniforms, Color *colors) {
+    Uniforms *u = static_cast<Uniforms *>(_uniforms);
+
+    for (int i = 0; i < FRAGMENT_PACKET_SIZE; i++) {
+        colors[i] = color_brightness(u, packet->custom[0][i]);
+    }
+}
+
+void fragment_packet_textured(FragmentPacket *packet, uint32_t mask, void *_uniforms, Color *colors) {
+    Uniforms *u = static_cast<Uniforms *>(_uniforms);
+
+    float brightness[FRAGMENT_PACKET_SIZE];
+    packet_lambert(packet, u->light_dir, brightness);
+
+    // All lanes are of one triangle, so of one material
+    Image *texture = material_texture(u, packet->material_id);
+    if (texture == nullptr) {
+        for (int i = 0; i < FRAGMENT_PACKET_SIZE; i++) {
+            colors[i] = color_brightness(u, brightness[i]);
+        }
+        return;
+    }
+
+    // Fetches are one lane at a time anyway, so the lanes that aren't
+    // written are skipped
+    while (mask) {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        Color texel = texture_texel(texture, packet->u[i], packet->v[i]);
+        colors[i] = texel_brightness(texel, brightness[i]);
+    }
+}
+// SECTION_END
+
+// Clip space -> screen space, keeping w for the perspective correct
+// interpolation
+inline Vec4f clip_to_screen(Vec4f clip, int half_width, int half_height) {
+    return {
+        (clip.x / clip.w * half_width) + half_width,
+        (clip.y / clip.w * half_height) + half_height,
+        clip.z / clip.w, // z must be in NDC
+        clip.w,
+    };
+}
+
+// Matrices of the vertex stage. The visibility buffer resolve uses them as
+// well, to redo project_mesh for a face.
+static VisibilityMeshTransform mesh_transform(
+    Matrix4 *mat_world,
+    Matrix4 *mat_view,
+    Matrix4 *mat_projection
+) {
+    auto mat_inversed = inverse_matrix(mat_view);
+
+    return {
+        .mat_model_clip = mat4_multiply(mat4_multiply(*mat_world, *mat_view), *mat_projection),
+        .mat_normal = transpose_matrix(&mat_inversed),
+    };
+}
+
+// Which faces of the mesh to drop when backface culling. Their winding
+// on screen follows the front face winding unless the world matrix or the
+// projection mirrors them.
+static TriangleCull mesh_backface_cull(
+    TinyMesh *mesh,
+    Matrix4 *mat_world,
+    Matrix4 *mat_projection,
+    bool enabled
+) {
+    if (!enabled) {
+        return TRIANGLE_CULL_NONE;
+    }
+
+    bool mirrored = mat4_determinant_3x3(mat_world) * mat_projection->m0 * mat_projection->m5 < 0.f;
+    bool front_ccw = (mesh->front_face == FACE_WINDING_COUNTER_CLOCKWISE) != mirrored;
+
+    return front_ccw ? TRIANGLE_CULL_CLOCKWISE : TRIANGLE_CULL_COUNTER_CLOCKWISE;
+}
+
+// Custom varyings are only there when the program has a vertex shader
+static void vertex_custom_fetch(ShaderProgram *program, VertexStageOutput *vertices, int idx, TinyVertex *out) {
+    if (program->vertex_shader == nullptr) {
+        return;
+    }
+
+    for (int k = 0; k < VARYING_CUSTOM_SLOTS; k++) {
+        out->custom[k] = vertices->custom[k][idx];
+    }
+}
 
+// Rasterizes a screen space triangle, or bins it when binning
+static void submit_triangle(
+    TinyTriangle *triangle,
+    uint32_t triangle_id,
+    ColorBuffer *color_buffer,
+    DepthBuffer *depth_buffer,
+    CameraType camera_type,
+    ShaderProgram *program,
+    TileBins *tile_bins,
+    GBuffer *g_buffer,
+    VisibilityBuffer *visibility_buffer
+) {
+    if (tile_bins != nullptr) {
+        tile_bins_add(tile_bins, triangle, triangle_id);
+        return;
+    }
 
+    depth_test(
+        camera_type,
+        color_buffer,
+        depth_buffer,
+        triangle,
+        program->fragment_shader,
+        program->uniforms,
+        nullptr,
+        g_buffer,
+        triangle_id,
+        visibility_buffer
+    );
+}
+
+// Primitive assembly: builds the triangles of a shape from the vertex stage
+// output and rasterizes or bins them
 static void project_mesh(
     TinyMesh *mesh,
     size_t shape_idx,
+    VertexStageOutput *vertices,
+    GuardBand *guard_band,
+    TriangleCull cull,
+    FaceRange *ranges,
+    size_t range_count,
+    ClassifiedFaces *classified,
     ColorBuffer *color_buffer,
     DepthBuffer * depth_buffer,
-    Matrix4 *mat_world,
-    Matrix4 *mat_view,
     CameraType camera_type,
-    FragmentShader fragment_shader
+    ShaderProgram *program,
+    TileBins *tile_bins,
+    GBuffer *g_buffer,
+    VisibilityBuffer *visibility_buffer,
+    uint32_t mesh_idx
 ) {
-    size_t face_buffer_idx = 0;
-
     int target_half_width = color_buffer->width / 2;
     int target_half_height = color_buffer->height / 2;
 
-    Vec4f v_view[3];
-    Vec3f normals[3];
+    PS_MeshShape *shape = &mesh->shapes[shape_idx];
 
-    auto mat_inversed = inverse_matrix(mat_view);
-    Matrix4 mat_view_tr_inv = transpose_matrix(&mat_inversed);
+    // Drops the faces that can't be seen and splits the rest by whether
+    // they need clipping
+    triangle_classify_shape(shape, ranges, range_count, vertices, cull, classified);
+
+    TinyTriangle triangles[POLYGON_MAX_TRIANGLES] = {};
+    size_t triangle_count = 0;
 
-    for (int i = 0; i < mesh->shapes[shape_idx].face_count; i++) {
-        TinyFace *face = &(mesh->shapes[shape_idx].faces[i]);
+    // Inside the guard band, straight to the screen
+    for (size_t k = 0; k < classified->inside_count; k++) {
+        uint32_t face_idx = classified->inside[k];
+        TinyFace *face = &shape->faces[face_idx];
 
-        // model -> view
         for (int j = 0; j < 3; j++) {
-            v_view[j] = transform_model_view(mesh->vertices[face->indices[j]].position, mat_world, mat_view);
-            normals[j] = vec3_from_vec4(mat4_multiply_vec4(
-                mat_view_tr_inv,
-                vec4_from_vec3(mesh->vertices[face->indices[j]].normal, false)
-            ));
+            int idx = face->indices[j];
+            Vec4f position = {
+                vertices->clip_x[idx],
+                vertices->clip_y[idx],
+                vertices->clip_z[idx],
+                vertices->clip_w[idx],
+            };
+
+            triangles[0].vertices[j] = {
+                .position = clip_to_screen(position, target_half_width, target_half_height),
+                .normal = { vertices->normal_x[idx], vertices->normal_y[idx], vertices->normal_z[idx] },
+                .texcoords = mesh->vertices[idx].texcoords,
+            };
+            vertex_custom_fetch(program, vertices, idx, &triangles[0].vertices[j]);
         }
 
-        // SECTION: backface culling
-        // auto triangle_normal = get_triangle_normal(v_view);
-        // TODO: put back, now it seems to work incorrect with orhographic projection
-        // if (renderer_state.flags[CULL_BACKFACE]) {
-            // Vec3f camera_ray = -vec3_from_vec4(v_view[0]);
-            // float dot_normal_cam = Vec3f::dot(camera_ray, triangle_normal);
-            //
-            // if (dot_normal_cam < 0.f) {
-            //     continue;
-            // }
-        // }
-        // SECTION_END
-
-        // TODO: define in the begining and write data here right away
-        TinyPolygon polygon = polygon_from_triangle(
-            v_view[0],
-            v_view[1],
-            v_view[2],
-            mesh->vertices[face->indices[0]].texcoords,
-            mesh->vertices[face->indices[1]].texcoords,
-            mesh->vertices[face->indices[2]].texcoords,
-            normals[0],
-            normals[1],
-            normals[2]
+        submit_triangle(
+            &triangles[0],
+            triangle_id_make(mesh_idx, shape_idx, face_idx),
+            color_buffer,
+            depth_buffer,
+            camera_type,
+            program,
+            tile_bins,
+            g_buffer,
+            visibility_buffer
         );
+    }
 
-        // Clip the polygon
-        if (camera_type == CameraType::PERSPECTIVE) {
-            clip_polygon(&polygon, clipping_planes_persp);
-        } else {
-            clip_polygon(&polygon, clipping_planes_ortho);
-        }
+    for (size_t k = 0; k < classified->clipped_count; k++) {
+        uint32_t face_idx = classified->clipped[k];
+        TinyFace *face = &shape->faces[face_idx];
 
-        // Triangulate the polygon
-        TinyTriangle triangles[POLYGON_MAX_TRIANGLES] = {};
-        size_t triangle_count = 0;
+        TinyPolygon polygon;
+        int outcodes = 0;
 
+        for (int j = 0; j < 3; j++) {
+            int idx = face->indices[j];
+
+            polygon.vertices[j] = {
+                .position = {
+                    vertices->clip_x[idx],
+                    vertices->clip_y[idx],
+                    vertices->clip_z[idx],
+                    vertices->clip_w[idx],
+                },
+                .normal = { vertices->normal_x[idx], vertices->normal_y[idx], vertices->normal_z[idx] },
+                .texcoords = mesh->vertices[idx].texcoords,
+            };
+            vertex_custom_fetch(program, vertices, idx, &polygon.vertices[j]);
+            outcodes |= vertices->outcodes[idx];
+        }
+        polygon.vertex_count = 3;
+
+        // Crossing the side planes is fine within the guard band, only near
+        // and far always make new vertices. The band can be narrower than
+        // the view volume, so the side outcodes don't tell which of its
+        // planes were crossed.
+        int clip_planes = outcodes & (CLIP_OUTCODE_NEAR | CLIP_OUTCODE_FAR);
+        if (outcodes & CLIP_OUTCODE_GUARD_BAND) {
+            clip_planes |= CLIP_OUTCODE_SIDES;
+        }
+
+        clip_polygon(&polygon, clip_planes, guard_band);
         triangulate_polygon(&polygon, triangles, &triangle_count);
 
-        for (int t_idx = 0; t_idx < triangle_count; t_idx++) {
+        for (size_t t_idx = 0; t_idx < triangle_count; t_idx++) {
             for (int v_idx = 0; v_idx < 3; v_idx++) {
-                // This gives me the image space or NDC
-                auto triangle_position = triangles[t_idx].vertices[v_idx].position;
-
-                Vec4f v_projected;
-
-                if (camera_type == CameraType::PERSPECTIVE) {
-                    v_projected = mat4_multiply_projection_vec4(
-                        camera_perspective.projection_matrix,
-                        triangle_position
-                    );
-                } else {
-                    v_projected = mat4_multiply_projection_vec4(
-                        camera_orthographic.projection_matrix,
-                        triangle_position
-                    );
-                }
-
-                // In-camera view
-                triangles[t_idx].vertices[v_idx].position = {
-                    (v_projected.x * target_half_width) + target_half_width,
-                    (v_projected.y * target_half_height) + target_half_height,
-                    v_projected.z, // z must be in NDC
-                    v_projected.w,
-                };
+                Vec4f *position = &triangles[t_idx].vertices[v_idx].position;
+                *position = clip_to_screen(*position, target_half_width, target_half_height);
             }
 
-            depth_test(
-                camera_type,
+            submit_triangle(
+                &triangles[t_idx],
+                triangle_id_make(mesh_idx, shape_idx, face_idx),
                 color_buffer,
                 depth_buffer,
-                &triangles[t_idx],
-                fragment_shader
+                camera_type,
+                program,
+                tile_bins,
+                g_buffer,
+                visibility_buffer
             );
         }
     }
@@ -221,6 +502,21 @@ void Program::init(int width, int height) {
     renderer_state.flags.set(CULL_BACKFACE, 1);
     renderer_state.flags.set(USE_Z_BUFFER, 1);
     renderer_state.flags.set(USE_SHADING, 1);
+    renderer_state.flags.set(USE_TILE_BINNING, 1);
+    renderer_state.flags.set(USE_MULTITHREADING, 1);
+    renderer_state.flags.set(USE_SIMD, 1);
+    renderer_state.flags.set(USE_DEFERRED_SHADING, 0);
+    renderer_state.flags.set(USE_VISIBILITY_BUFFER, 0);
+
+    // Raster kernels with the shaders inlined
+    raster_register_shader<fragment_shader_depth, FRAGMENT_VARYING_DEPTH, fragment_packet_depth>();
+    raster_register_shader<fragment_shader_main, FRAGMENT_VARYING_NORMAL, fragment_packet_main>();
+    raster_register_shader<fragment_shader_gouraud, FRAGMENT_VARYING_CUSTOM, fragment_packet_gouraud>();
+    raster_register_shader<
+        fragment_shader_textured,
+        FRAGMENT_VARYING_UV | FRAGMENT_VARYING_NORMAL,
+        fragment_packet_textured
+    >();
 
     std::vector<std::string> medic_textures = {
         "assets/medic-eyeball.png",
@@ -237,8 +533,13 @@ void Program::init(int width, int height) {
     auto plane_mesh = ps_load_mesh(plane_obj_path, plane_textures);
     // auto p_body_mesh = ps_load_mesh(p_body_obj_path, p_body_textures);
 
-    medic_mesh->translation.y = -1.0f;
-    plane_mesh->translation.y = -1.0f;
+    // Meshes that don't fit are logged and left out
+    if (medic_mesh) {
+        medic_mesh->translation.y = -1.0f;
+    }
+    if (plane_mesh) {
+        plane_mesh->translation.y = -1.0f;
+    }
     // medic_mesh->translation.x = -1.0f;
 
     // p_body_mesh->translation.y = -1.0f;
@@ -270,26 +571,162 @@ void Program::init(int width, int height) {
         log_message(LogLevel::LOG_LEVEL_ERROR, "Failed to create depth buffer");
     }
 
+    g_buffer = g_buffer_create(width, height);
+    visibility_buffer = visibility_buffer_create(width, height);
+    tile_bins = tile_bins_create(width, height);
+    job_pool = job_pool_create(0);
+
     face_buffer = (TinyTriangle *)malloc(FACE_BUFFER_SIZE_LIMIT * sizeof(TinyTriangle));
+}
+
+void Program::render_pass(
+    Matrix4 *view_matrix,
+    Matrix4 *projection_matrix,
+    CameraType camera_type,
+    ShaderProgram *program,
+    ColorBuffer *color_buffer,
+    DepthBuffer *depth_buffer,
+    GuardBand *guard_band,
+    TileBins *bins,
+    JobPool *pool,
+    GBuffer *deferred,
+    VisibilityBuffer *visibility,
+    VisibilityScene *visibility_scene,
+    size_t mesh_count
+) {
+    if (deferred != nullptr) {
+        g_buffer_clear(deferred);
+    }
+    if (visibility != nullptr) {
+        visibility_buffer_clear(visibility);
+    }
 
-    float aspect_ratio_x = 1 / aspect_ratio;
-    float camera_fov_x = 2 * atan(tan(camera_fov_y / 2) * aspect_ratio_x);
+    for (size_t i = 0; i < mesh_count; i++) {
+        auto mesh = &visibility_scene->meshes[i];
+        VisibilityMeshTransform *transform = &visibility_scene->transforms[i];
 
-    init_clipping_planes_perspective(
-        clipping_planes_persp,
-        camera_fov_x,
-        camera_fov_y,
-        camera_perspective.z_near,
-        camera_perspective.z_far
-    );
+        Matrix4 mat_world = mat4_get_world(
+            mesh->scale,
+            mesh->rotation,
+            mesh->translation
+        );
 
-    init_clipping_planes_orthographic(
-        clipping_planes_ortho,
-        2.0, -2.0,
-        -2.0, 2.0,
-        camera_orthographic.z_near,
-        camera_orthographic.z_far
-    );
+        *transform = mesh_transform(&mat_world, view_matrix, projection_matrix);
+
+        // Bounds are tested in model space, against the planes of the
+        // model to clip space matrix
+        Frustum frustum = frustum_from_matrix(&transform->mat_model_clip);
+        if (!frustum_test_bounds(&frustum, &mesh->bounds, &mesh->bounding_sphere)) {
+            continue;
+        }
+
+        TriangleCull cull = mesh_backface_cull(
+            mesh,
+            &mat_world,
+            projection_matrix,
+            renderer_state.flags[CULL_BACKFACE]
+        );
+        Vec4f eye = meshlet_eye(&transform->mat_model_clip);
+
+        // TODO: Im pretty sure I could do this loop inside project mesh, right?
+        // or pass down the shape instead
+        for (size_t shape_idx = 0; shape_idx < mesh->shape_count; shape_idx++) {
+            PS_MeshShape *shape = &mesh->shapes[shape_idx];
+            if (!frustum_test_bounds(&frustum, &shape->bounds, &shape->bounding_sphere)) {
+                continue;
+            }
+
+            // Faces of the BVH nodes that aren't outside
+            visible_ranges.clear();
+            bvh_frustum_ranges(shape, &frustum, &visible_ranges);
+
+            // Of those, the meshlets that aren't outside or facing away,
+            // and the vertices they use
+            meshlet_faces.clear();
+            meshlet_vertices.clear();
+            meshlets_cull(
+                shape,
+                visible_ranges.data(),
+                visible_ranges.size(),
+                &frustum,
+                eye,
+                cull,
+                &meshlet_faces,
+                &meshlet_vertices
+            );
+            if (meshlet_faces.empty()) {
+                continue;
+            }
+
+            vertex_stage_run(
+                mesh,
+                meshlet_vertices.data(),
+                meshlet_vertices.size(),
+                &transform->mat_model_clip,
+                &transform->mat_normal,
+                guard_band,
+                program->vertex_shader,
+                program->uniforms,
+                &vertex_output
+            );
+
+            project_mesh(
+                mesh,
+                shape_idx,
+                &vertex_output,
+                guard_band,
+                cull,
+                meshlet_faces.data(),
+                meshlet_faces.size(),
+                &classified_faces,
+                color_buffer,
+                depth_buffer,
+                camera_type,
+                program,
+                bins,
+                deferred,
+                visibility,
+                i
+            );
+        }
+    }
+
+    if (bins != nullptr) {
+        tile_bins_flush(
+            bins,
+            camera_type,
+            color_buffer,
+            depth_buffer,
+            program->fragment_shader,
+            program->uniforms,
+            pool,
+            deferred,
+            visibility
+        );
+    }
+
+    if (deferred != nullptr) {
+        g_buffer_resolve(
+            deferred,
+            depth_buffer,
+            color_buffer,
+            program->fragment_shader,
+            program->uniforms,
+            pool
+        );
+    }
+
+    if (visibility != nullptr) {
+        visibility_buffer_resolve(
+            visibility,
+            visibility_scene,
+            depth_buffer,
+            color_buffer,
+            program->fragment_shader,
+            program->uniforms,
+            pool
+        );
+    }
 }
 
 void Program::update(ColorBuffer *color_buffer) {
@@ -317,58 +754,96 @@ void Program::update(ColorBuffer *color_buffer) {
         vec4_from_vec3(light.direction, false)
     );
 
-    uniforms.light_dir = vec3_from_vec4(light_direction_projected);
+    // Bound to the main pass draws, which are done by the end of the frame
+    Uniforms main_uniforms = uniforms_make(vec3_from_vec4(light_direction_projected), default_color, mesh_data);
+
+    // When binning, passes only collect triangles, and they are rasterized
+    // tile by tile once the pass is submitted
+    TileBins *bins = renderer_state.flags[USE_TILE_BINNING] ? tile_bins : nullptr;
+    // Tiles are handed out to the job pool, without binning everything runs
+    // on this thread
+    JobPool *pool = renderer_state.flags[USE_MULTITHREADING] ? job_pool : nullptr;
+
+    raster_use_simd(renderer_state.flags[USE_SIMD]);
+    vertex_stage_use_simd(renderer_state.flags[USE_SIMD]);
+    triangle_classify_use_simd(renderer_state.flags[USE_SIMD]);
+
+    // Deferred passes fill the G-buffer, and every pixel is shaded once
+    // when the pass is resolved
+    GBuffer *deferred = renderer_state.flags[USE_DEFERRED_SHADING] ? g_buffer : nullptr;
+    // Same, but passes only store triangle ids, and the resolve fetches the
+    // faces from the meshes again. Takes precedence over the G-buffer.
+    VisibilityBuffer *visibility = renderer_state.flags[USE_VISIBILITY_BUFFER] ? visibility_buffer : nullptr;
+    if (visibility != nullptr) {
+        deferred = nullptr;
+    }
 
-    // Depth pass
-    Matrix4 mat_world;
-    for (size_t i = 0; i < mesh_count; i++) {
-        auto mesh = &mesh_data[i];
+    GuardBand guard_band = clip_guard_band(
+        color_buffer->width,
+        color_buffer->height,
+        GUARD_BAND_PIXELS,
+        RASTER_MAX_COORDINATE
+    );
 
-        mat_world = mat4_get_world(
-            mesh->scale,
-            mesh->rotation,
-            mesh->translation
-        );
+    ShaderProgram light_program = {
+        .vertex_shader = nullptr,
+        .fragment_shader = fragment_shader_depth,
+        .uniforms = nullptr,
+    };
 
-        for (int i = 0; i < mesh->shape_count; i++) {
-            project_mesh(
-                mesh,
-                i,
-                color_buffer,
-                depth_buffer_light,
-                &mat_world,
-                &camera_orthographic.view_matrix,
-                CameraType::ORTHOGRAPHIC,
-                fragment_shader_depth
-            );
-        }
+    // Lighting per vertex needs the custom varyings, which the G-buffer and
+    // the visibility buffer don't keep
+    bool gouraud = renderer_state.flags[USE_GOURAUD_SHADING] && deferred == nullptr && visibility == nullptr;
+    ShaderProgram main_program = {
+        .vertex_shader = gouraud ? vertex_shader_gouraud : nullptr,
+        .fragment_shader = gouraud ? fragment_shader_gouraud : fragment_shader_main,
+        .uniforms = &main_uniforms,
+    };
+    // Texturing takes precedence, every path keeps texture coordinates
+    if (renderer_state.flags[USE_TEXTURES]) {
+        main_program.vertex_shader = nullptr;
+        main_program.fragment_shader = fragment_shader_textured;
     }
 
-    // Main camera
-    for (size_t i = 0; i < mesh_count; i++) {
-        auto mesh = &mesh_data[i];
+    std::vector<VisibilityMeshTransform> visibility_transforms(mesh_count);
+    VisibilityScene visibility_scene = {
+        .meshes = mesh_data,
+        .transforms = visibility_transforms.data(),
+    };
 
-        mat_world = mat4_get_world(
-            mesh->scale,
-            mesh->rotation,
-            mesh->translation
-        );
+    // Depth pass
+    render_pass(
+        &camera_orthographic.view_matrix,
+        &camera_orthographic.projection_matrix,
+        CameraType::ORTHOGRAPHIC,
+        &light_program,
+        color_buffer,
+        depth_buffer_light,
+        &guard_band,
+        bins,
+        pool,
+        deferred,
+        visibility,
+        &visibility_scene,
+        mesh_count
+    );
 
-        // TODO: Im pretty sure I could do this loop inside project mesh, right?
-        // or pass down the shape instead
-        for (int shape_idx = 0; shape_idx < mesh->shape_count; shape_idx++) {
-            project_mesh(
-                mesh,
-                shape_idx,
-                color_buffer,
-                depth_buffer,
-                &mat_world,
-                &camera_perspective.view_matrix,
-                CameraType::PERSPECTIVE, // TODO: camera type can be recognised from the camera itsef
-                fragment_shader_main
-            );
-       }
-    }
+    // Main camera
+    render_pass(
+        &camera_perspective.view_matrix,
+        &camera_perspective.projection_matrix,
+        CameraType::PERSPECTIVE, // TODO: camera type can be recognised from the camera itsef
+        &main_program,
+        color_buffer,
+        depth_buffer,
+        &guard_band,
+        bins,
+        pool,
+        deferred,
+        visibility,
+        &visibility_scene,
+        mesh_count
+    );
 
     BeginTextureMode(render_texture);
     UpdateTexture(render_texture.texture, color_buffer->pixels);
@@ -431,6 +906,69 @@ void Program::handle_input(float delta_time) {
         );
     }
 
+    if (IsKeyPressed(KEY_B)) {
+        renderer_state.flags.flip(USE_TILE_BINNING);
+        log_message(
+            LogLevel::LOG_LEVEL_DEBUG,
+            "Tile binning: %d",
+            static_cast<int>(renderer_state.flags[USE_TILE_BINNING])
+        );
+    }
+
+    if (IsKeyPressed(KEY_M)) {
+        renderer_state.flags.flip(USE_MULTITHREADING);
+        log_message(
+            LogLevel::LOG_LEVEL_DEBUG,
+            "Multithreading: %d",
+            static_cast<int>(renderer_state.flags[USE_MULTITHREADING])
+        );
+    }
+
+    if (IsKeyPressed(KEY_V)) {
+        renderer_state.flags.flip(USE_SIMD);
+        log_message(
+            LogLevel::LOG_LEVEL_DEBUG,
+            "SIMD rasterization: %d",
+            static_cast<int>(renderer_state.flags[USE_SIMD])
+        );
+    }
+
+    if (IsKeyPressed(KEY_G)) {
+        renderer_state.flags.flip(USE_DEFERRED_SHADING);
+        log_message(
+            LogLevel::LOG_LEVEL_DEBUG,
+            "Deferred shading: %d",
+            static_cast<int>(renderer_state.flags[USE_DEFERRED_SHADING])
+        );
+    }
+
+    if (IsKeyPressed(KEY_I)) {
+        renderer_state.flags.flip(USE_VISIBILITY_BUFFER);
+        log_message(
+            LogLevel::LOG_LEVEL_DEBUG,
+            "Visibility buffer: %d",
+            static_cast<int>(renderer_state.flags[USE_VISIBILITY_BUFFER])
+        );
+    }
+
+    if (IsKeyPressed(KEY_L)) {
+        renderer_state.flags.flip(USE_GOURAUD_SHADING);
+        log_message(
+            LogLevel::LOG_LEVEL_DEBUG,
+            "Gouraud shading: %d",
+            static_cast<int>(renderer_state.flags[USE_GOURAUD_SHADING])
+        );
+    }
+
+    if (IsKeyPressed(KEY_X)) {
+        renderer_state.flags.flip(USE_TEXTURES);
+        log_message(
+            LogLevel::LOG_LEVEL_DEBUG,
+            "Textures: %d",
+            static_cast<int>(renderer_state.flags[USE_TEXTURES])
+        );
+    }
+
     if (IsKeyPressed(KEY_ONE)) {
         renderer_state.flags.flip(DRAW_VERTICES);
         log_message(
@@ -517,5 +1055,11 @@ void Program::handle_input(float delta_time) {
 void Program::cleanup() {
     UnloadRenderTexture(this->render_texture);
     depth_buffer_destroy(depth_buffer);
+    g_buffer_destroy(g_buffer);
+    visibility_buffer_destroy(visibility_buffer);
+    tile_bins_destroy(tile_bins);
+    job_pool_destroy(job_pool);
     free(face_buffer);
+    vertex_stage_free(&vertex_output);
+    classified_faces_free(&classified_faces);
 }
@@ -2,11 +2,21 @@
 
 #include <stdint.h>
 
+#include "../core/bvh.h"
 #include "../core/color_buffer.h"
 #include "../core/depth_buffer.h"
+#include "../core/g_buffer.h"
 #include "../core/matrix.h"
 #include "../core/mesh.h"
+#include "../core/meshlet.h"
 #include "../core/camera.h"
+#include "../core/clipping.h"
+#include "../core/gl.h"
+#include "../core/job_pool.h"
+#include "../core/tile_renderer.h"
+#include "../core/triangle_classify.h"
+#include "../core/vertex_stage.h"
+#include "../core/visibility_buffer.h"
 #include "../light.h"
 
 #include "renderer.h"
@@ -20,6 +30,26 @@ struct Program {
 
     void handle_input(float delta_time);
 
+    // Draws every mesh of the scene from one camera: culls, runs the vertex
+    // stage and rasterizes or bins the faces, then flushes the bins and
+    // resolves the deferred buffers into color_buffer. Fills the scene's
+    // transforms, which the visibility resolve reads.
+    void render_pass(
+        Matrix4 *view_matrix,
+        Matrix4 *projection_matrix,
+        CameraType camera_type,
+        ShaderProgram *program,
+        ColorBuffer *color_buffer,
+        DepthBuffer *depth_buffer,
+        GuardBand *guard_band,
+        TileBins *bins,
+        JobPool *pool,
+        GBuffer *deferred,
+        VisibilityBuffer *visibility,
+        VisibilityScene *visibility_scene,
+        size_t mesh_count
+    );
+
     Light light;
 
     RendererState renderer_state;
@@ -27,7 +57,21 @@ struct Program {
     TinyTriangle *face_buffer = nullptr;
     size_t face_buffer_size = 0;
 
+    // Output of the vertex stage for the meshlets being drawn
+    VertexStageOutput vertex_output = {};
+    // Faces of the shape being drawn inside the frustum by its BVH
+    std::vector<FaceRange> visible_ranges;
+    // Faces and vertices of its meshlets that weren't culled
+    std::vector<FaceRange> meshlet_faces;
+    std::vector<VertexRange> meshlet_vertices;
+    // Faces that survived classification
+    ClassifiedFaces classified_faces = {};
+
     DepthBuffer *depth_buffer = nullptr;
+    GBuffer *g_buffer = nullptr;
+    VisibilityBuffer *visibility_buffer = nullptr;
+    TileBins *tile_bins = nullptr;
+    JobPool *job_pool = nullptr;
 
     RenderTexture2D render_texture;
 };
@@ -19,6 +19,14 @@ enum RenderingFlags {
     USE_Z_BUFFER,
 
     CULL_BACKFACE,
+
+    USE_TILE_BINNING,
+    USE_MULTITHREADING,
+    USE_SIMD,
+    USE_DEFERRED_SHADING,
+    USE_VISIBILITY_BUFFER,
+    USE_GOURAUD_SHADING,
+    USE_TEXTURES,
 };
 
 struct RendererState {